@@ -1,13 +1,74 @@
 #include <algorithm>
+#include <cstdio>
+#include <cstring>
 #include "aps6404.hpp"
 #include "hardware/dma.h"
 #include "hardware/irq.h"
 #include "hardware/sync.h"
 #include "hardware/clocks.h"
+#include "hardware/structs/timer.h"
 #include "pico/stdlib.h"
 #include "aps6404.pio.h"
 
 namespace pimoroni {
+    namespace {
+        APS6404* irq_instance = nullptr;
+
+        struct ReadProgram {
+            const pio_program* prog;
+            bool slow;
+            bool fast;
+            uint8_t wait_instr;  // Offset of the "set x" for the read wait loop
+            uint16_t clkdiv;
+        };
+
+        // Indexed by APS6404::ReadProgramOption
+        const ReadProgram read_programs[] = {
+            { &sram_fast_program, false, true, sram_fast_offset_do_read + 1, 1 },
+            { &sram_program, false, false, sram_offset_do_read, 1 },
+            { &sram_slow_program, true, false, sram_slow_offset_do_read + 1, 1 },
+            { &sram_program, false, false, sram_offset_do_read, 2 },
+            { &sram_slow_program, true, false, sram_slow_offset_do_read + 1, 2 },
+            { &sram_fast_program, false, true, sram_fast_offset_do_read + 1, 2 },
+        };
+
+        // Latency adjustments swept by calibrate(), most preferred first.  A wait loop iteration is
+        // a whole PSRAM clock, so at most one of these reads back correctly for each option.
+        constexpr int latency_adjust_options[] = { 0, 1, -1 };
+        constexpr int num_latency_adjust_options = sizeof(latency_adjust_options) / sizeof(latency_adjust_options[0]);
+
+        // The option at the same divider sampling half a PSRAM clock earlier or later, or -1 if
+        // there isn't one.  calibrate() only selects an option if this also reads back correctly
+        // with the same latency, so that there is margin on the sample point.
+        constexpr int8_t sample_point_partners[] = {
+            -1,
+            APS6404::READ_SLOW,
+            APS6404::READ_NORMAL,
+            APS6404::READ_SLOW_DIV2,
+            APS6404::READ_NORMAL_DIV2,
+            -1,
+        };
+        static_assert(sizeof(sample_point_partners) == APS6404::NUM_READ_PROGRAM_OPTIONS, "Sample point partner needed for each read option");
+
+        // Each test pattern is read back this many times by every option, to catch marginal timing
+        constexpr int num_calibration_reads = 4;
+
+        // Reads and writes may only cross a page boundary at PSRAM clocks up to this rate
+        constexpr uint32_t LINEAR_BURST_MAX_HZ = 84000000;
+
+        // Maximum QPI read clock in the APS6404 datasheet.  calibrate() won't select an option
+        // above this, even if it happens to read back correctly.
+        constexpr uint32_t MAX_PSRAM_CLOCK_HZ = 133000000;
+
+        uint32_t get_psram_clock_hz(const ReadProgram& read_program) {
+            return clock_get_hz(clk_sys) / (read_program.clkdiv * (read_program.fast ? 3 : 2));
+        }
+
+        uint32_t calibration_pattern(uint32_t seed, uint32_t i) {
+            return seed ^ (i * 0x9E3779B9u);
+        }
+    }
+
     APS6404::APS6404(uint pin_csn, uint pin_d0, PIO pio)
                 : pin_csn(pin_csn)
                 , pin_d0(pin_d0)
@@ -19,133 +80,338 @@ namespace pimoroni {
             gpio_disable_pulls(pin_d0 + i);
         }
 
-        pio_prog = &sram_reset_program;
-        pio_offset = pio_add_program(pio, &sram_reset_program);
+        // The command program stays loaded, the read program is added by load_read_program()
+        reset_offset = pio_add_program(pio, &sram_reset_program);
         pio_sm = pio_claim_unused_sm(pio, true);
 
         // Claim DMA channels
         dma_channel = dma_claim_unused_channel(true);
         read_cmd_dma_channel = dma_claim_unused_channel(true);
+        ctrl_dma_channel = dma_claim_unused_channel(true);
+
+        // The control channel writes one control block to the data channel each time it is triggered
+        dma_channel_config c = dma_channel_get_default_config(ctrl_dma_channel);
+        channel_config_set_read_increment(&c, true);
+        channel_config_set_write_increment(&c, true);
+        channel_config_set_ring(&c, true, 4);
+        channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+
+        dma_channel_configure(
+            ctrl_dma_channel, &c,
+            &dma_hw->ch[dma_channel].al1_ctrl,
+            nullptr,
+            sizeof(DMAControlBlock) / 4,
+            false
+        );
+
+        // The last block of each chain copies the timer to chain_end_time, unpaced
+        c = dma_channel_get_default_config(dma_channel);
+        channel_config_set_read_increment(&c, false);
+        channel_config_set_write_increment(&c, false);
+        channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+        channel_config_set_chain_to(&c, ctrl_dma_channel);
+        channel_config_set_irq_quiet(&c, true);
+        chain_end_ctrl = channel_config_get_ctrl_value(&c);
     }
 
     void APS6404::init() {
-        aps6404_reset_program_init(pio, pio_sm, pio_offset, pin_csn, pin_d0);
+        aps6404_pins_init(pio, pio_sm, pin_csn, pin_d0);
+        reset_config = aps6404_program_get_config(reset_offset, pin_csn, pin_d0, false, false, true);
+        run_program(reset_offset, reset_config);
 
         sleep_us(200);
-        pio_sm_put_blocking(pio, pio_sm, 0x00000007u);
-        pio_sm_put_blocking(pio, pio_sm, 0x66000000u);
-        pio_sm_put_blocking(pio, pio_sm, 0x00000007u);
-        pio_sm_put_blocking(pio, pio_sm, 0x99000000u);
-        pio_sm_put_blocking(pio, pio_sm, 0x00000007u);
-        pio_sm_put_blocking(pio, pio_sm, 0x35000000u);
+        send_spi_command(0x66);
+        send_spi_command(0x99);
+        send_spi_command(0x35);
         sleep_us(500);
 
         adjust_clock();
     }
 
     void APS6404::set_qpi() {
-        pio_sm_set_enabled(pio, pio_sm, false);
-        pio_remove_program(pio, pio_prog, pio_offset);
-
-        pio_prog = &sram_reset_program;
-        pio_offset = pio_add_program(pio, &sram_reset_program);
-        aps6404_reset_program_init(pio, pio_sm, pio_offset, pin_csn, pin_d0);
-        pio_sm_put_blocking(pio, pio_sm, 0x00000007u);
-        pio_sm_put_blocking(pio, pio_sm, 0x35000000u);
+        run_program(reset_offset, reset_config);
+        send_spi_command(0x35);
 
-        while (!pio_sm_is_tx_fifo_empty(pio, pio_sm) || pio->sm[pio_sm].addr != pio_offset);
+        while (!pio_sm_is_tx_fifo_empty(pio, pio_sm) || pio->sm[pio_sm].addr != reset_offset);
 
-        adjust_clock();
+        run_program(pio_offset, read_config);
     }
 
     void APS6404::set_spi() {
-        pio_sm_set_enabled(pio, pio_sm, false);
-        pio_remove_program(pio, pio_prog, pio_offset);
-
-        pio_prog = &sram_reset_qpi_program;
-        pio_offset = pio_add_program(pio, &sram_reset_qpi_program);
-        aps6404_program_init(pio, pio_sm, pio_offset, pin_csn, pin_d0, false, false, true);
+        run_program(reset_offset, reset_config);
         pio_sm_put_blocking(pio, pio_sm, 0x00000001u);
         pio_sm_put_blocking(pio, pio_sm, 0xF5000000u);
     }
 
+    void APS6404::run_program(uint offset, const pio_sm_config& config) {
+        // Both programs are resident, so this only reconfigures the state machine and jumps
+        pio_sm_init(pio, pio_sm, offset, &config);
+        pio_sm_set_enabled(pio, pio_sm, true);
+    }
+
+    void APS6404::send_spi_command(uint8_t cmd) {
+        // The command program sends a nibble per clock, so spread each bit of the command onto D0
+        uint32_t word = 0;
+        for (int i = 0; i < 8; ++i) {
+            word |= ((cmd >> i) & 1) << (i * 4);
+        }
+
+        pio_sm_put_blocking(pio, pio_sm, 0x00000007u);
+        pio_sm_put_blocking(pio, pio_sm, word);
+        pio_sm_put_blocking(pio, pio_sm, 0);
+    }
+
     void APS6404::adjust_clock() {
+        if (calibration.selected_option >= 0 && calibration.clock_hz == clock_get_hz(clk_sys)) {
+            load_read_program(calibration.selected_option, calibration.latency_adjust[calibration.selected_option]);
+        }
+        else {
+            load_read_program(get_default_read_option(), 0);
+        }
+    }
+
+    APS6404::ReadProgramOption APS6404::get_default_read_option() {
+        if (clock_get_hz(clk_sys) > 296000000) return READ_FAST;
+        else if (clock_get_hz(clk_sys) < 130000000) return READ_SLOW;
+        else return READ_NORMAL;
+    }
+
+    void APS6404::load_read_program(int option, int latency_adjust) {
+        const ReadProgram& read_program = read_programs[option];
+
         pio_sm_set_enabled(pio, pio_sm, false);
-        pio_remove_program(pio, pio_prog, pio_offset);
+        if (read_prog_loaded) pio_remove_program(pio, &read_prog, pio_offset);
+
+        // The wait count is in the low 5 bits of the set instruction
+        memcpy(read_prog_instructions, read_program.prog->instructions, read_program.prog->length * sizeof(uint16_t));
+        read_prog_instructions[read_program.wait_instr] += latency_adjust;
+        read_prog = *read_program.prog;
+        read_prog.instructions = read_prog_instructions;
+
+        pio_offset = pio_add_program(pio, &read_prog);
+        read_prog_loaded = true;
+        read_config = aps6404_program_get_config(pio_offset, pin_csn, pin_d0, read_program.slow, read_program.fast, false);
+        linear_burst = get_psram_clock_hz(read_program) <= LINEAR_BURST_MAX_HZ;
+        sm_config_set_clkdiv_int_frac(&read_config, read_program.clkdiv, 0);
+        run_program(pio_offset, read_config);
+    }
 
-        if (clock_get_hz(clk_sys) > 296000000) {
-            pio_prog = &sram_fast_program;
-            pio_offset = pio_add_program(pio, &sram_fast_program);
-            aps6404_program_init(pio, pio_sm, pio_offset, pin_csn, pin_d0, false, true, false);
+    const APS6404::Calibration& APS6404::calibrate(uint32_t* buffer, uint32_t buffer_len_in_words) {
+        constexpr uint32_t test_addr = RAM_SIZE - PAGE_SIZE;
+        constexpr uint32_t test_len_in_words = PAGE_SIZE >> 2;
+        constexpr uint32_t seeds[] = { 0x00000000u, 0xFFFFFFFFu, 0x5A5AA5A5u, 0x0FF0F00Fu };
+        constexpr int num_bandwidth_reads = 16;
+
+        assert(buffer_len_in_words >= 2 * test_len_in_words);
+        uint32_t* const saved_data = buffer;
+        uint32_t* const test_data = buffer + test_len_in_words;
+
+        calibration = Calibration();
+        const ReadProgramOption default_option = get_default_read_option();
+        load_read_program(default_option, 0);
+        read_blocking(test_addr, saved_data, test_len_in_words);
+
+        // Patterns are always written with the default program, so that only the reads are being tested.
+        // Options that would run the PSRAM above its rated clock are not tried.
+        bool passed[NUM_READ_PROGRAM_OPTIONS][num_latency_adjust_options];
+        for (int option = 0; option < NUM_READ_PROGRAM_OPTIONS; ++option) {
+            const bool in_spec = get_psram_clock_hz(read_programs[option]) <= MAX_PSRAM_CLOCK_HZ;
+            for (int j = 0; j < num_latency_adjust_options; ++j) {
+                passed[option][j] = in_spec;
+            }
         }
-        else if (clock_get_hz(clk_sys) < 130000000) {
-            pio_prog = &sram_slow_program;
-            pio_offset = pio_add_program(pio, &sram_slow_program);
-            aps6404_program_init(pio, pio_sm, pio_offset, pin_csn, pin_d0, true, false, false);
+        for (uint32_t seed : seeds) {
+            load_read_program(default_option, 0);
+            for (uint32_t i = 0; i < test_len_in_words; ++i) {
+                test_data[i] = calibration_pattern(seed, i);
+            }
+            write(test_addr, test_data, test_len_in_words);
+            wait_for_finish_blocking();
+
+            for (int option = 0; option < NUM_READ_PROGRAM_OPTIONS; ++option) {
+                for (int j = 0; j < num_latency_adjust_options; ++j) {
+                    if (!passed[option][j]) continue;
+
+                    load_read_program(option, latency_adjust_options[j]);
+                    for (int k = 0; k < num_calibration_reads && passed[option][j]; ++k) {
+                        memset(test_data, 0, test_len_in_words * 4);
+                        read_blocking(test_addr, test_data, test_len_in_words);
+                        for (uint32_t i = 0; i < test_len_in_words; ++i) {
+                            if (test_data[i] != calibration_pattern(seed, i)) {
+                                passed[option][j] = false;
+                                break;
+                            }
+                        }
+                    }
+                }
+            }
         }
-        else {
-            pio_prog = &sram_program;
-            pio_offset = pio_add_program(pio, &sram_program);
-            aps6404_program_init(pio, pio_sm, pio_offset, pin_csn, pin_d0, false, false, false);
+
+        uint32_t best_mb_per_s = 0;
+        for (int option = 0; option < NUM_READ_PROGRAM_OPTIONS; ++option) {
+            const int partner = sample_point_partners[option];
+            for (int j = 0; j < num_latency_adjust_options; ++j) {
+                if (!passed[option][j] || (partner >= 0 && !passed[partner][j])) continue;
+
+                load_read_program(option, latency_adjust_options[j]);
+                const uint32_t start_time = time_us_32();
+                for (int k = 0; k < num_bandwidth_reads; ++k) {
+                    read_blocking(test_addr, test_data, test_len_in_words);
+                }
+                const uint32_t read_time = std::max(time_us_32() - start_time, uint32_t(1));
+
+                // Bytes per us is MB/s
+                const uint32_t mb_per_s = std::min((num_bandwidth_reads * PAGE_SIZE) / read_time, uint32_t(255));
+                calibration.latency_adjust[option] = latency_adjust_options[j];
+                calibration.mb_per_s[option] = mb_per_s;
+                if (mb_per_s > best_mb_per_s) {
+                    best_mb_per_s = mb_per_s;
+                    calibration.selected_option = option;
+                }
+                break;
+            }
+            printf("PSRAM read option %d: latency %+d, %dMB/s\n", option, calibration.latency_adjust[option], calibration.mb_per_s[option]);
         }
+
+        calibration.clock_hz = clock_get_hz(clk_sys);
+        adjust_clock();
+        write(test_addr, saved_data, test_len_in_words);
+        wait_for_finish_blocking();
+
+        return calibration;
     }
 
-    void APS6404::write(uint32_t addr, uint32_t* data, uint32_t len_in_words) {
+    void APS6404::write(uint32_t addr, uint32_t* data, uint32_t len_in_words, void (*callback)()) {
         wait_for_finish_blocking();
 
         setup_cmd_buffer_dma(true);
 
+        // Both the commands and the data go to the PIO through the data channel, which is reprogrammed
+        // by the control channel for each block.  The blocks are IRQ quiet, so that the only IRQ is
+        // raised by the null trigger at the end of the chain.
+        dma_channel_config c = dma_channel_get_default_config(dma_channel);
+        channel_config_set_read_increment(&c, true);
+        channel_config_set_write_increment(&c, false);
+        channel_config_set_dreq(&c, pio_get_dreq(pio, pio_sm, true));
+        channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+        channel_config_set_chain_to(&c, ctrl_dma_channel);
+        channel_config_set_irq_quiet(&c, true);
+        const uint32_t cmd_ctrl = channel_config_get_ctrl_value(&c);
+        channel_config_set_bswap(&c, true);
+        const uint32_t data_ctrl = channel_config_get_ctrl_value(&c);
+
+        uint32_t* cmd_buf = multi_read_cmd_buffer;
+        DMAControlBlock* block = chain_blocks;
         for (int len = len_in_words, page_len = std::min((PAGE_SIZE - (addr & (PAGE_SIZE - 1))) >> 2, len_in_words); 
              len > 0; 
              addr += page_len << 2, data += page_len, len -= page_len, page_len = std::min(PAGE_SIZE >> 2, len))
         {
-            wait_for_finish_blocking();
+            if (block == &chain_blocks[2 * MULTI_WRITE_MAX_PAGES]) {
+                // Chain is full, send it and then start building the next one
+                start_control_chain(block);
+                wait_for_finish_blocking();
 
-            pio_sm_put_blocking(pio, pio_sm, (page_len * 8) - 1);
-            pio_sm_put_blocking(pio, pio_sm, 0x38000000u | addr);
-            pio_sm_put_blocking(pio, pio_sm, pio_offset + sram_offset_do_write);
+                cmd_buf = multi_read_cmd_buffer;
+                block = chain_blocks;
+            }
+
+            *block++ = {cmd_ctrl, cmd_buf, &pio->txf[pio_sm], 3};
+            *cmd_buf++ = (page_len * 8) - 1;
+            *cmd_buf++ = 0x38000000u | addr;
+            *cmd_buf++ = pio_offset + sram_offset_do_write;
+
+            *block++ = {data_ctrl, data, &pio->txf[pio_sm], (uint32_t)page_len};
+        }
+
+        if (callback) {
+            write_callback = callback;
+            enable_dma_irq();
+        }
+
+        start_control_chain(block);
+    }
+
+    void APS6404::start_control_chain(DMAControlBlock* block) {
+        // The chain records its end time and then stops at the null block
+        *block++ = {chain_end_ctrl, &timer_hw->timerawl, &chain_end_time, 1};
+        *block++ = {chain_end_ctrl, nullptr, nullptr, 0};
+
+        ctrl_chain_end = (uintptr_t)block;
+        start_transfer_timing(true);
+        dma_channel_set_read_addr(ctrl_dma_channel, chain_blocks, true);
+    }
+
+    void APS6404::start_transfer_timing(bool chain) {
+        transfer_start_time = time_us_32();
+        transfer_running = true;
+        transfer_is_chain = chain;
+    }
+
+    void APS6404::end_transfer_timing() {
+        if (!transfer_running) return;
+
+        // Other transfers are only seen to end when they are waited for
+        const uint32_t end_time = transfer_is_chain ? chain_end_time : time_us_32();
+        traffic.busy_us += end_time - transfer_start_time;
+        transfer_running = false;
+    }
 
-            dma_channel_config c = dma_channel_get_default_config(dma_channel);
-            channel_config_set_read_increment(&c, true);
-            channel_config_set_write_increment(&c, false);
-            channel_config_set_dreq(&c, pio_get_dreq(pio, pio_sm, true));
-            channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
-            channel_config_set_bswap(&c, true);
-            
-            dma_channel_configure(
-                dma_channel, &c,
-                &pio->txf[pio_sm],
-                data,
-                page_len,
-                true
-            );
+    void APS6404::enable_dma_irq() {
+        if (!irq_instance) {
+            irq_instance = this;
+            irq_add_shared_handler(DMA_IRQ_1, dma_irq_handler, PICO_SHARED_IRQ_HANDLER_DEFAULT_ORDER_PRIORITY);
+            irq_set_enabled(DMA_IRQ_1, true);
         }
+        dma_channel_acknowledge_irq1(dma_channel);
+        dma_channel_set_irq1_enabled(dma_channel, true);
     }
 
-    void APS6404::read(uint32_t addr, uint32_t* read_buf, uint32_t len_in_words) {
+    void APS6404::dma_irq_handler() {
+        APS6404* const ram = irq_instance;
+        if (!dma_channel_get_irq1_status(ram->dma_channel)) return;
+
+        dma_channel_acknowledge_irq1(ram->dma_channel);
+        dma_channel_set_irq1_enabled(ram->dma_channel, false);
+
+        void (*callback)() = ram->write_callback;
+        ram->write_callback = nullptr;
+        if (callback) callback();
+    }
+
+    void APS6404::clear_traffic() {
+        traffic = {};
+    }
+
+    void APS6404::read(uint32_t addr, uint32_t* read_buf, uint32_t len_in_words, uint8_t consumer) {
         start_read(read_buf, len_in_words);
 
+        ReadTraffic& read_traffic = traffic.consumers[consumer];
+        read_traffic.bytes += len_in_words << 2;
+
         uint32_t first_page_len = (PAGE_SIZE - (addr & (PAGE_SIZE - 1)));
 
-        if (first_page_len >= len_in_words << 2) {
+        if (linear_burst || first_page_len >= len_in_words << 2) {
             pio_sm_put_blocking(pio, pio_sm, (len_in_words * 8) - 4);
             pio_sm_put_blocking(pio, pio_sm, 0xeb000000u | addr);
             pio_sm_put_blocking(pio, pio_sm, pio_offset + sram_offset_do_read);
+            ++read_traffic.commands;
         }
         else {
             // Must always reset the cmd buffer DMA because writes use the same DREQ
             setup_cmd_buffer_dma();
-            uint32_t* cmd_buf = add_read_to_cmd_buffer(multi_read_cmd_buffer, addr, len_in_words);
+            uint32_t* cmd_buf = add_read_to_cmd_buffer(multi_read_cmd_buffer, addr, len_in_words, read_traffic);
             dma_channel_transfer_from_buffer_now(read_cmd_dma_channel, multi_read_cmd_buffer, cmd_buf - multi_read_cmd_buffer);
         }
     }
 
-    void APS6404::multi_read(uint32_t* addresses, uint32_t* lengths, uint32_t num_reads, uint32_t* read_buf, int chain_channel) {
+    void APS6404::multi_read(uint32_t* addresses, uint32_t* lengths, uint32_t num_reads, uint32_t* read_buf, int chain_channel, uint8_t consumer) {
         uint32_t total_len = 0;
         uint32_t* cmd_buf = multi_read_cmd_buffer;
+        ReadTraffic& read_traffic = traffic.consumers[consumer];
         for (uint32_t i = 0; i < num_reads; ++i) {
             total_len += lengths[i];
-            cmd_buf = add_read_to_cmd_buffer(cmd_buf, addresses[i], lengths[i]);
+            read_traffic.bytes += lengths[i] << 2;
+            cmd_buf = add_read_to_cmd_buffer(cmd_buf, addresses[i], lengths[i], read_traffic);
         }
 
         start_read(read_buf, total_len, chain_channel);
@@ -154,6 +420,89 @@ namespace pimoroni {
         dma_channel_transfer_from_buffer_now(read_cmd_dma_channel, multi_read_cmd_buffer, cmd_buf - multi_read_cmd_buffer);
     }
 
+    uint32_t APS6404::queue_read(uint32_t addr, uint32_t* read_buf, uint32_t len_in_words, uint8_t consumer) {
+        // Each read must fit in the command buffer on its own
+        assert(len_in_words <= (MULTI_READ_MAX_PAGES - 3) * (PAGE_SIZE >> 2));
+
+        while (read_ring_head - read_batch_start == READ_RING_SIZE) {
+            if (read_ring_submitted == read_batch_start) submit_reads();
+            wait_for_finish_blocking();
+        }
+
+        read_ring[read_ring_head & (READ_RING_SIZE - 1)] = {addr, read_buf, len_in_words, consumer};
+        return read_ring_head++;
+    }
+
+    void APS6404::submit_reads() {
+        if (read_ring_submitted == read_ring_head) return;
+
+        wait_for_finish_blocking();
+
+        // The commands are sent as for multi_read, but the data channel is reprogrammed by the
+        // control channel for each read so that it can land in a different buffer.
+        dma_channel_config c = dma_channel_get_default_config(dma_channel);
+        channel_config_set_read_increment(&c, false);
+        channel_config_set_write_increment(&c, true);
+        channel_config_set_dreq(&c, pio_get_dreq(pio, pio_sm, false));
+        channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
+        channel_config_set_bswap(&c, true);
+        channel_config_set_chain_to(&c, ctrl_dma_channel);
+        channel_config_set_irq_quiet(&c, true);
+        const uint32_t data_ctrl = channel_config_get_ctrl_value(&c);
+
+        uint32_t* cmd_buf = multi_read_cmd_buffer;
+        uint32_t* const cmd_buf_end = multi_read_cmd_buffer + 3 * MULTI_READ_MAX_PAGES;
+        DMAControlBlock* block = chain_blocks;
+
+        // Reads that carry on from the previous one in PSRAM are merged into a single command,
+        // each still gets its own data block so it can land in a different buffer.
+        // The commands are counted against the consumer of the first read.
+        uint32_t run_addr = 0;
+        uint32_t run_len = 0;
+        uint8_t run_consumer = 0;
+        for (; read_ring_submitted != read_ring_head; ++read_ring_submitted) {
+            const ReadDescriptor& desc = read_ring[read_ring_submitted & (READ_RING_SIZE - 1)];
+
+            if (run_len && desc.addr == run_addr + (run_len << 2)) {
+                if (cmd_buf + get_max_read_cmd_len(run_len + desc.len_in_words) > cmd_buf_end) break;
+                run_len += desc.len_in_words;
+            }
+            else {
+                if (run_len) cmd_buf = add_read_to_cmd_buffer(cmd_buf, run_addr, run_len, traffic.consumers[run_consumer]);
+                if (cmd_buf + get_max_read_cmd_len(desc.len_in_words) > cmd_buf_end) {
+                    run_len = 0;
+                    break;
+                }
+                run_addr = desc.addr;
+                run_len = desc.len_in_words;
+                run_consumer = desc.consumer;
+            }
+            traffic.consumers[desc.consumer].bytes += desc.len_in_words << 2;
+
+            *block++ = {data_ctrl, &pio->rxf[pio_sm], desc.read_buf, desc.len_in_words};
+        }
+        if (run_len) cmd_buf = add_read_to_cmd_buffer(cmd_buf, run_addr, run_len, traffic.consumers[run_consumer]);
+
+        start_control_chain(block);
+        setup_cmd_buffer_dma();
+        dma_channel_transfer_from_buffer_now(read_cmd_dma_channel, multi_read_cmd_buffer, cmd_buf - multi_read_cmd_buffer);
+    }
+
+    bool APS6404::is_read_complete(uint32_t id) {
+        if (int32_t(id - read_batch_start) < 0) return true;
+        if (int32_t(id - read_ring_submitted) >= 0) return false;
+
+        // The read is in the running chain.  The control channel only starts reading the
+        // next block once the data channel has finished the read.
+        return dma_hw->ch[ctrl_dma_channel].read_addr > (uintptr_t)&chain_blocks[id - read_batch_start + 1];
+    }
+
+    void APS6404::wait_for_read(uint32_t id) {
+        while (!is_read_complete(id)) {
+            if (int32_t(id - read_ring_submitted) >= 0) submit_reads();
+        }
+    }
+
     void APS6404::start_read(uint32_t* read_buf, uint32_t total_len_in_words, int chain_channel) {
         wait_for_finish_blocking();
 
@@ -167,6 +516,7 @@ namespace pimoroni {
             channel_config_set_chain_to(&c, chain_channel);
         }
         
+        start_transfer_timing(false);
         dma_channel_configure(
             dma_channel, &c,
             read_buf,
@@ -192,9 +542,15 @@ namespace pimoroni {
         );
     }
 
-    uint32_t* APS6404::add_read_to_cmd_buffer(uint32_t* cmd_buf, uint32_t addr, uint32_t len_in_words) {
+    uint32_t APS6404::get_max_read_cmd_len(uint32_t len_in_words) {
+        // Worst case is a partial page at each end plus a clear command
+        if (linear_burst) return 3;
+        return 3 * ((len_in_words / (PAGE_SIZE >> 2)) + 3);
+    }
+
+    uint32_t* APS6404::add_read_to_cmd_buffer(uint32_t* cmd_buf, uint32_t addr, uint32_t len_in_words, ReadTraffic& read_traffic) {
         int32_t len_remaining = len_in_words << 2;
-        uint32_t len = std::min((PAGE_SIZE - (addr & (PAGE_SIZE - 1))), (uint32_t)len_remaining);
+        uint32_t len = linear_burst ? (uint32_t)len_remaining : std::min((PAGE_SIZE - (addr & (PAGE_SIZE - 1))), (uint32_t)len_remaining);
         bool clear_isr = false;
 
         while (true) {
@@ -207,10 +563,12 @@ namespace pimoroni {
             *cmd_buf++ = (len * 2) - 4;
             *cmd_buf++ = 0xeb000000u | addr;
             *cmd_buf++ = pio_offset + sram_offset_do_read;
+            ++read_traffic.commands;
             len_remaining -= len;
             addr += len;
 
             if (len_remaining <= 0) break;
+            ++read_traffic.page_splits;
 
             len = len_remaining;
             if (len > PAGE_SIZE) len = PAGE_SIZE;
@@ -220,12 +578,29 @@ namespace pimoroni {
             *cmd_buf++ = 0;
             *cmd_buf++ = 0xeb000000u | addr;
             *cmd_buf++ = pio_offset + sram_offset_do_clear;
+            ++read_traffic.commands;
         }
 
         return cmd_buf;
     }
 
+    bool APS6404::is_busy() {
+        if (ctrl_chain_end && (dma_channel_is_busy(ctrl_dma_channel) || dma_hw->ch[ctrl_dma_channel].read_addr != ctrl_chain_end)) {
+            return true;
+        }
+        return dma_channel_is_busy(dma_channel);
+    }
+
     void APS6404::wait_for_finish_blocking() {
+        if (ctrl_chain_end) {
+            // The data channel is briefly idle between blocks, so the chain is only complete
+            // once the control channel has read the null block.
+            while (dma_channel_is_busy(ctrl_dma_channel) || dma_hw->ch[ctrl_dma_channel].read_addr != ctrl_chain_end)
+                ;
+            ctrl_chain_end = 0;
+            read_batch_start = read_ring_submitted;
+        }
         dma_channel_wait_for_finish_blocking(dma_channel);
+        end_transfer_timing();
     }
 }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stdint.h>
+#include <algorithm>
 #include "hardware/pio.h"
 
 namespace pimoroni {
@@ -13,51 +14,184 @@ namespace pimoroni {
 
             void init();
 
+            // Switch the PSRAM between QPI and SPI mode.  The PIO programs for both modes stay
+            // loaded so this doesn't touch the PIO instruction memory.
             void set_qpi();
             void set_spi();
 
             // Must be called if the system clock rate is changed after init().
+            // Uses the calibrated read program if calibrate() has been run at this clock rate.
             void adjust_clock();
 
+            // Read program options swept by calibrate(), from fastest to slowest
+            enum ReadProgramOption {
+                READ_FAST = 0,          // PSRAM clock at 1/3 system clock
+                READ_NORMAL = 1,        // 1/2 system clock, sample half a cycle late
+                READ_SLOW = 2,          // 1/2 system clock
+                READ_NORMAL_DIV2 = 3,   // As above with the state machine clock divided by 2
+                READ_SLOW_DIV2 = 4,
+                READ_FAST_DIV2 = 5,
+                NUM_READ_PROGRAM_OPTIONS
+            };
+
+            struct Calibration {
+                uint32_t clock_hz = 0;       // System clock the calibration was run at
+                int8_t selected_option = -1; // -1 if no option read back correctly
+                int8_t latency_adjust[NUM_READ_PROGRAM_OPTIONS] = {};  // Change to read wait cycles that worked for each option
+                uint8_t mb_per_s[NUM_READ_PROGRAM_OPTIONS] = {};       // Measured read bandwidth, 0 if the option failed
+            };
+
+            // Sweep the read program options, checking test patterns read back correctly and measuring
+            // bandwidth, and select the fastest reliable option.  An option is only reliable if it is
+            // within the PSRAM's rated clock, reads every pattern correctly several times, and the option
+            // sampling half a cycle away at the same divider (if any) also reads correctly.  The test
+            // area at the top of RAM is restored afterwards.  buffer is scratch space of at least 2 pages.
+            const Calibration& calibrate(uint32_t* buffer, uint32_t buffer_len_in_words);
+            const Calibration& get_calibration() const { return calibration; }
+
             // Start a write, this completes asynchronously, this function blocks if another 
-            // transfer is already in progress
-            // Writes should always be <= 1KB.
-            void write(uint32_t addr, uint32_t* data, uint32_t len_in_words);
+            // transfer is already in progress.
+            // Writes of up to MULTI_WRITE_MAX_PAGES pages run as a single DMA chain, longer
+            // writes block until all but the last chain has been sent.
+            // If callback is set it is called from the DMA IRQ once the write completes.
+            void write(uint32_t addr, uint32_t* data, uint32_t len_in_words, void (*callback)() = nullptr);
 
             // Start a read, this completes asynchronously, this function only blocks if another 
             // transfer is already in progress
-            void read(uint32_t addr, uint32_t* read_buf, uint32_t len_in_words);
+            void read(uint32_t addr, uint32_t* read_buf, uint32_t len_in_words, uint8_t consumer = 0);
 
             // Start multiple reads to the same buffer.  They completes asynchronously, 
             // this function only blocks if another transfer is already in progress
-            void multi_read(uint32_t* addresses, uint32_t* lengths, uint32_t num_addresses, uint32_t* read_buf, int chain_channel = -1);
+            void multi_read(uint32_t* addresses, uint32_t* lengths, uint32_t num_addresses, uint32_t* read_buf, int chain_channel = -1, uint8_t consumer = 0);
 
             // Read and block until completion
-            void read_blocking(uint32_t addr, uint32_t* read_buf, uint32_t len_in_words) {
-                read(addr, read_buf, len_in_words);
+            void read_blocking(uint32_t addr, uint32_t* read_buf, uint32_t len_in_words, uint8_t consumer = 0) {
+                read(addr, read_buf, len_in_words, consumer);
                 wait_for_finish_blocking();
             }
 
+            // Scatter-gather reads.  Each read is queued in a descriptor ring with its own destination
+            // and nothing is started until submit_reads is called.  Returns an id for polling completion.
+            // This only blocks if the ring is full.
+            uint32_t queue_read(uint32_t addr, uint32_t* read_buf, uint32_t len_in_words, uint8_t consumer = 0);
+
+            // Start all queued reads as one DMA chain, this only blocks if another transfer is already
+            // in progress.  Reads that continue on from the previous queued read in PSRAM share a
+            // single command.  If the commands for the queued reads would overflow the command buffer
+            // then the remaining reads are left queued for the next call.
+            void submit_reads();
+
+            // Poll whether a queued read has completed
+            bool is_read_complete(uint32_t id);
+
+            // Block until a queued read has completed, submitting it if necessary
+            void wait_for_read(uint32_t id);
+
             // Block until any outstanding read or write completes
             void wait_for_finish_blocking();
 
+            // Whether a read or write is in progress
+            bool is_busy();
+
+            static constexpr int MULTI_WRITE_MAX_PAGES = 32;
+            static constexpr int READ_RING_SIZE = 64;
+
+            // Read traffic is counted for each consumer, an id passed with each read
+            static constexpr int MAX_READ_CONSUMERS = 8;
+            struct ReadTraffic {
+                uint32_t bytes;
+                uint32_t commands;
+                uint32_t page_splits;  // Extra commands because a read crossed a page boundary
+            };
+            struct Traffic {
+                uint32_t busy_us;      // Time reads and writes were running
+                ReadTraffic consumers[MAX_READ_CONSUMERS];
+            };
+            const Traffic& get_traffic() const { return traffic; }
+            void clear_traffic();
+
         private:
+            // Layout matches the DMA channel alias 1 registers, so that a control channel
+            // can write one block to reprogram and trigger the data channel.
+            struct DMAControlBlock {
+                uint32_t ctrl;
+                const volatile void* read_addr;
+                volatile void* write_addr;
+                uint32_t transfer_count;
+            };
+
             void start_read(uint32_t* read_buf, uint32_t total_len_in_words, int chain_channel = -1);
             void setup_cmd_buffer_dma(bool clear = false);
-            uint32_t* add_read_to_cmd_buffer(uint32_t* cmd_buf, uint32_t addr, uint32_t len_in_words);
+            uint32_t get_max_read_cmd_len(uint32_t len_in_words);
+            uint32_t* add_read_to_cmd_buffer(uint32_t* cmd_buf, uint32_t addr, uint32_t len_in_words, ReadTraffic& read_traffic);
+            void start_control_chain(DMAControlBlock* block);
+            void start_transfer_timing(bool chain);
+            void end_transfer_timing();
+            void enable_dma_irq();
+            static void dma_irq_handler();
+            ReadProgramOption get_default_read_option();
+            void load_read_program(int option, int latency_adjust);
+            void run_program(uint offset, const pio_sm_config& config);
+            void send_spi_command(uint8_t cmd);
 
             uint pin_csn;  // CSn, SCK must be next pin after CSn
             uint pin_d0;   // D0, D1, D2, D3 must be consecutive
 
             PIO pio;
             uint16_t pio_sm;
-            uint16_t pio_offset;
-            const pio_program* pio_prog;
+            uint16_t pio_offset;    // Read program
+            uint16_t reset_offset;  // Command program, used to reset and to switch mode
+            pio_sm_config read_config;
+            pio_sm_config reset_config;
+
+            // Copy of the read program with the wait cycles adjusted
+            pio_program read_prog;
+            uint16_t read_prog_instructions[32];
+            bool read_prog_loaded = false;
+
+            // Set when the PSRAM clock is low enough for bursts to cross page boundaries
+            bool linear_burst = false;
+
+            Calibration calibration;
 
             uint dma_channel;
             uint read_cmd_dma_channel;
+            uint ctrl_dma_channel;
+
+            // Read address of the control channel once the current chain is complete, or 0 if no chain running.
+            uintptr_t ctrl_chain_end = 0;
+            void (*write_callback)() = nullptr;
+
+            // Each transfer is timed from when it is started until it is next waited for.  Chains
+            // end by DMAing the timer to chain_end_time, so they are timed without an IRQ.
+            Traffic traffic = {};
+            uint32_t transfer_start_time = 0;
+            bool transfer_running = false;
+            bool transfer_is_chain = false;
+            volatile uint32_t chain_end_time = 0;
+            uint32_t chain_end_ctrl;
 
             static constexpr int MULTI_READ_MAX_PAGES = 128;
             uint32_t multi_read_cmd_buffer[3 * MULTI_READ_MAX_PAGES];
+
+            // Control blocks for the running chain.  Writes use a command and data block for
+            // each page, scatter-gather reads a block per read, plus a block to record the end
+            // time and a null block to end the chain.
+            static constexpr int MAX_CHAIN_BLOCKS = std::max(2 * MULTI_WRITE_MAX_PAGES, READ_RING_SIZE) + 2;
+            alignas(16) DMAControlBlock chain_blocks[MAX_CHAIN_BLOCKS];
+
+            struct ReadDescriptor {
+                uint32_t addr;
+                uint32_t* read_buf;
+                uint32_t len_in_words;
+                uint8_t consumer;
+            };
+
+            // Reads before read_batch_start are complete, reads up to read_ring_submitted are
+            // in the running chain, and reads up to read_ring_head are queued but not yet started.
+            ReadDescriptor read_ring[READ_RING_SIZE];
+            uint32_t read_batch_start = 0;
+            uint32_t read_ring_submitted = 0;
+            uint32_t read_ring_head = 0;
     };
 }
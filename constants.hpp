@@ -1,34 +1,33 @@
 #pragma once
 
-#ifndef SUPPORT_WIDE_MODES
-#define SUPPORT_WIDE_MODES 0
-#endif
-
 constexpr int PALETTE_SIZE = 32;
+constexpr int MAX_PALETTES = 8;  // Per frame
 constexpr int NUM_SCROLL_OFFSETS = 4;
 
-#if !SUPPORT_WIDE_MODES
-// Support for normal modes, require <300MHz overclock, 
-// work on pretty much any screen, up to 32 sprites.
+// Limits across all supported resolutions.  The line buffers, TMDS buffers, patches and
+// sprite line tables are carved from the display arena at init to suit the resolution,
+// so the number of sprites and TMDS buffers available depends on the resolution.
+// The arena includes room for the full resolution TMDS LUTs, which are only allocated
+// while frames have full resolution lines.
+// Modes above 720x576 require extreme overclocks and don't work on all screens.
 constexpr int MAX_SPRITES = 32;
-constexpr int MAX_FRAME_WIDTH = 720;
-constexpr int MAX_FRAME_HEIGHT = 576;
-constexpr int MAX_SPRITE_DATA_BYTES = 2048;
-constexpr int MAX_SPRITE_WIDTH = 64;
-constexpr int MAX_SPRITE_HEIGHT = 64;
-constexpr int MAX_PATCHES_PER_LINE = 10;
-constexpr int NUM_LINE_BUFFERS = 4;
-constexpr int NUM_TMDS_BUFFERS = 8;
-#else
-// Support for modes up to 720p30, require extreme overclocks
-// doesn't work on all screens.  Only 16 sprites
-constexpr int MAX_SPRITES = 16;
 constexpr int MAX_FRAME_WIDTH = 1280;
 constexpr int MAX_FRAME_HEIGHT = 720;
-constexpr int MAX_SPRITE_DATA_BYTES = 2048;
-constexpr int MAX_SPRITE_WIDTH = 64;
-constexpr int MAX_SPRITE_HEIGHT = 64;
+constexpr int MAX_SPRITE_WIDTH = 255;
+constexpr int MAX_SPRITE_HEIGHT = 255;
 constexpr int MAX_PATCHES_PER_LINE = 10;
+constexpr int MAX_SPRITE_ASSIGNMENTS = 64;  // Extra uses of the sprite slots, see DisplayDriver::set_sprite_assignment
 constexpr int NUM_LINE_BUFFERS = 4;
-constexpr int NUM_TMDS_BUFFERS = 7;
-#endif
\ No newline at end of file
+constexpr int MIN_TMDS_BUFFERS = 7;
+constexpr int MAX_TMDS_BUFFERS = 8;  // Limited by the depth of the DVI TMDS queues
+constexpr int DISPLAY_ARENA_BYTES = 228 * 1024;
+
+// Consumers of PSRAM reads, for the per frame traffic diags
+enum RamConsumer {
+    RAM_LINE_DATA,
+    RAM_FRAME_TABLE,     // Including the headers and line scroll
+    RAM_PALETTE,
+    RAM_SPRITE_HEADERS,  // Sprite table entries and line tables
+    RAM_SPRITE_DATA,
+    NUM_RAM_CONSUMERS
+};
@@ -9,6 +9,7 @@
 #include "pico/multicore.h"
 
 #include "pins.hpp"
+#include "profile.hpp"
 
 extern "C" {
 #include "dvi_serialiser.h"
@@ -26,8 +27,33 @@ using namespace pico_stick;
 
 #define TEST_SPRITES 0
 
+// Time kept back from the VSYNC budget when deciding which sprites to load, in us
+constexpr int32_t VSYNC_RESERVE_US = 100;
+
+// RAM read bandwidth assumed when budgeting sprite loads if it has not been calibrated
+constexpr uint32_t DEFAULT_RAM_MB_PER_S = 40;
+
+// Approximate time to load each sprite in addition to its line table transfer, in us
+constexpr int32_t SPRITE_LOAD_OVERHEAD_US = 4;
+
 static pico_stick::FrameTableEntry __attribute__((section(".usb_ram.frame_table"))) the_frame_table[MAX_FRAME_HEIGHT];
 
+namespace {
+    // Quad pixel lines are encoded as doubled pixels, giving words_per_channel words for each
+    // channel, then every word is repeated.  Works backwards so it can expand in place.
+    void tmds_repeat_words(uint32_t* tmds_buf, uint32_t words_per_channel) {
+        for (int c = 2; c >= 0; --c) {
+            const uint32_t* src = tmds_buf + c * words_per_channel + words_per_channel;
+            uint32_t* dst = tmds_buf + c * words_per_channel * 2 + words_per_channel * 2;
+            while (dst > tmds_buf + c * words_per_channel * 2) {
+                const uint32_t symbols = *--src;
+                *--dst = symbols;
+                *--dst = symbols;
+            }
+        }
+    }
+}
+
 DisplayDriver::DisplayDriver(PIO pio)
     : frame_data(ram)
     , current_res(RESOLUTION_720x480)
@@ -44,7 +70,7 @@ DisplayDriver::DisplayDriver(PIO pio)
     frame_table = the_frame_table;
 }
 
-bool DisplayDriver::set_res(pico_stick::Resolution res)
+const dvi_timing* DisplayDriver::get_timing(pico_stick::Resolution res)
 {
     const dvi_timing* normal_modes[] = {
         &dvi_timing_640x480p_60hz,
@@ -54,12 +80,9 @@ bool DisplayDriver::set_res(pico_stick::Resolution res)
     };
 
     if (res <= RESOLUTION_720x576) {
-        dvi0.timing = normal_modes[(int)res];
-        current_res = res;
-        return true;
+        return normal_modes[(int)res];
     }
 
-#if SUPPORT_WIDE_MODES
     const dvi_timing* wide_modes[] = {
         &dvi_timing_800x600p_60hz,
         &dvi_timing_800x480p_60hz,
@@ -70,13 +93,20 @@ bool DisplayDriver::set_res(pico_stick::Resolution res)
     };
 
     if (res >= RESOLUTION_800x600 && res <= RESOLUTION_1280x720) {
-        dvi0.timing = wide_modes[(int)res - (int)RESOLUTION_800x600];
-        current_res = res;
-        return true;
+        return wide_modes[(int)res - (int)RESOLUTION_800x600];
     }
-#endif
 
-    return false;
+    return nullptr;
+}
+
+bool DisplayDriver::set_res(pico_stick::Resolution res)
+{
+    const dvi_timing* timing = get_timing(res);
+    if (!timing) return false;
+
+    dvi0.timing = timing;
+    current_res = res;
+    return true;
 }
 
 namespace {
@@ -88,6 +118,7 @@ namespace {
 
 void DisplayDriver::run_core1() {
 	dvi_register_irqs_this_core(&dvi0, DMA_IRQ_0);
+    profile::init_core();
     while (true) {
         sem_acquire_blocking(&dvi_start_sem);
         printf("Core 1 up\n");
@@ -100,11 +131,11 @@ void DisplayDriver::run_core1() {
             if (!colourbuf) break;
 
             uint32_t *tmdsbuf = (uint32_t*)multicore_fifo_pop_blocking();
-            prepare_scanline_core1(line_counter, colourbuf, tmdsbuf, lmode);
+            (this->*scanline_encoders.core[1][lmode])(line_counter, colourbuf, tmdsbuf);
             multicore_fifo_push_blocking(0);
         }
 
-        // dvi_stop() - needs implementing
+        // dvi_stop() - not available in libdvi, so resolution changes restart the firmware instead
     }
     __builtin_unreachable();
 }
@@ -116,14 +147,11 @@ void DisplayDriver::init() {
     gpio_put(PIN_VSYNC, 0);
     gpio_set_dir(PIN_VSYNC, GPIO_OUT);
 
-    // Setup TMDS symbol LUTs
-    tmds_double_encode_setup_default_lut(tmds_15bpp_lut);
-    memcpy(tmds_palette_luts + (PALETTE_SIZE * PALETTE_SIZE * 6), tmds_15bpp_lut, PALETTE_SIZE * PALETTE_SIZE * 2);
-    memcpy(tmds_palette_luts + (PALETTE_SIZE * PALETTE_SIZE * 10), tmds_15bpp_lut, PALETTE_SIZE * PALETTE_SIZE * 2);
+    setup_arena();
 
     dvi_init(&dvi0, next_striped_spin_lock_num(), next_striped_spin_lock_num());
-    for (int i = 0; i < NUM_TMDS_BUFFERS; ++i) {
-        void* bufptr = (void*)&tmds_buffers[i * 3 * MAX_FRAME_WIDTH / DVI_SYMBOLS_PER_WORD];
+    for (int i = 0; i < num_tmds_buffers; ++i) {
+        void* bufptr = (void*)tmds_buffers[i];
         queue_add_blocking_u32(&dvi0.q_tmds_free, &bufptr);
     }
 	sem_init(&dvi_start_sem, 0, 1);
@@ -131,9 +159,9 @@ void DisplayDriver::init() {
 
     Sprite::init();
 
-    for (int i = 0; i < MAX_FRAME_HEIGHT; ++i) {
+    for (uint32_t i = 0; i < frame_height; ++i) {
         for (int j = 0; j < MAX_PATCHES_PER_LINE; ++j) {
-            patches[i][j].data = nullptr;
+            patches[i][j].len = 0;
         }
     }
 
@@ -149,19 +177,97 @@ void DisplayDriver::init() {
     printf("Available time per scanline: %luus\n", diags.available_time_per_scanline);
 }
 
+void DisplayDriver::setup_arena() {
+    frame_width = dvi0.timing->h_active_pixels;
+    frame_height = dvi0.timing->v_active_lines;
+
+    uint8_t* ptr = arena;
+    uint8_t* const arena_end = arena + DISPLAY_ARENA_BYTES;
+    auto alloc = [&ptr](uint32_t len) {
+        uint8_t* const buf = ptr;
+        ptr += (len + 3) & ~3;
+        return buf;
+    };
+
+    // Buffers needed at every resolution first.  The line buffers are free during VSYNC, so
+    // sprite assignments' line tables are loaded into them in batches.
+    assignment_line_tables = (uint32_t*)ptr;
+    line_buffer_words = ((frame_width + 1) * 3) / 2;
+    for (int i = 0; i < NUM_LINE_BUFFERS / 2; ++i) {
+        pixel_data[i] = (uint32_t*)alloc(line_buffer_words * sizeof(uint32_t));
+    }
+
+    sprite_line_buffer_bytes = frame_width * 2;
+    for (int i = 0; i < NUM_LINE_BUFFERS; ++i) {
+        sprite_data[i] = (uint32_t*)alloc(sprite_line_buffer_bytes);
+    }
+    assignment_loads_per_batch = std::min<int>(MAX_ASSIGNMENT_LOADS, (ptr - (uint8_t*)assignment_line_tables) / Sprite::LINE_TABLE_BYTES);
+
+    patches = (Sprite::BlendPatch (*)[MAX_PATCHES_PER_LINE])alloc(frame_height * sizeof(patches[0]));
+    line_address = (uint32_t*)alloc(frame_height * sizeof(uint32_t));
+    line_words = (uint16_t*)alloc(frame_height * sizeof(uint16_t));
+    line_modes = (int8_t*)alloc(frame_height);
+
+    const uint32_t tmds_buffer_bytes = 3 * frame_width * sizeof(uint32_t) / DVI_SYMBOLS_PER_WORD;
+    for (num_tmds_buffers = 0; num_tmds_buffers < MIN_TMDS_BUFFERS; ++num_tmds_buffers) {
+        tmds_buffers[num_tmds_buffers] = (uint32_t*)alloc(tmds_buffer_bytes);
+    }
+
+    // The full resolution TMDS LUTs go at the end of the arena when they are needed
+    constexpr uint32_t lut_bytes = TMDS_LUT_WORDS * sizeof(uint32_t);
+    if (ptr + lut_bytes > arena_end) {
+        panic("Display arena too small for resolution");
+    }
+    tmds_lut_space = (uint32_t*)(arena_end - lut_bytes);
+
+    // Then as many sprites as fit, and any space left over goes to extra TMDS buffers.  The
+    // extra TMDS buffers are placed first so that the LUTs only ever overlap sprite line tables.
+    const uint32_t max_sprites = std::min<uint32_t>(MAX_SPRITES, (arena_end - ptr) / Sprite::LINE_TABLE_BYTES);
+    const uint32_t sprite_bytes = std::max(max_sprites * ((Sprite::LINE_TABLE_BYTES + 3) & ~3), lut_bytes);
+    for (; num_tmds_buffers < MAX_TMDS_BUFFERS && ptr + tmds_buffer_bytes + sprite_bytes <= arena_end; ++num_tmds_buffers) {
+        tmds_buffers[num_tmds_buffers] = (uint32_t*)alloc(tmds_buffer_bytes);
+    }
+
+    num_sprites_with_luts = 0;
+    for (num_sprites = 0; num_sprites < MAX_SPRITES && ptr + Sprite::LINE_TABLE_BYTES <= arena_end; ++num_sprites) {
+        if (ptr + Sprite::LINE_TABLE_BYTES <= (uint8_t*)tmds_lut_space) ++num_sprites_with_luts;
+        sprites[num_sprites].set_line_table((SpriteLine*)alloc(Sprite::LINE_TABLE_BYTES));
+    }
+    num_active_sprites = num_sprites;
+    tmds_palette_luts = nullptr;
+    tmds_15bpp_lut = nullptr;
+    tmds_15bpp_lut_valid = false;
+
+    printf("Arena: %d sprites (%d with full res lines), %d TMDS buffers, %d bytes free\n",
+           num_sprites, num_sprites_with_luts, num_tmds_buffers, int(arena_end - ptr));
+}
+
+void DisplayDriver::calibrate_ram() {
+    if (spi_mode) {
+        ram.set_qpi();
+    }
+
+    // The line buffers are not in use yet, so can be used as scratch space
+    ram.calibrate(pixel_data[0], line_buffer_words);
+
+    if (spi_mode) {
+        ram.set_spi();
+    }
+}
+
 void DisplayDriver::run() {
 	multicore_launch_core1(core1_main);
     multicore_fifo_push_blocking(uint32_t(this));
+    profile::init_core();
 
     printf("DVI Initialized\n");
     sem_release(&dvi_start_sem);
 
 #if TEST_SPRITES
-    constexpr int num_sprites = MAX_SPRITES;
-    int32_t x[num_sprites];
-    int32_t y[num_sprites];
-    int32_t xdir[num_sprites];
-    int32_t ydir[num_sprites];
+    int32_t x[MAX_SPRITES];
+    int32_t y[MAX_SPRITES];
+    int32_t xdir[MAX_SPRITES];
+    int32_t ydir[MAX_SPRITES];
     constexpr int sprite_move_shift = 7;
 
     for (int i = 0; i < num_sprites; ++i) {
@@ -194,56 +300,9 @@ void DisplayDriver::run() {
 
         uint32_t vsync_start_time = time_us_32();
 
-        if (spi_mode) {
-            ram.set_qpi();
-        }
-
-        if (!frame_data.read_headers()) {
-            // TODO!
-            return;
-        }
-        //printf("%hdx%hd\n", frame_data.config.h_length, frame_data.config.v_length);
-
-        // Update frame counter
-        if (frame_data.frame_table_header.bank_number != last_bank) {
-            frame_counter = frame_data.frame_table_header.first_frame;
-            last_bank = frame_data.frame_table_header.bank_number;
-            frames_to_next_count = frame_data.frame_table_header.frame_rate_divider;
-        }
-        else if (frame_data.frame_table_header.frame_rate_divider != 0)
-        {
-            if (--frames_to_next_count <= 0) {
-                if (++frame_counter >= frame_data.frame_table_header.num_frames) {
-                    frame_counter = 0;
-                }
-                frames_to_next_count = frame_data.frame_table_header.frame_rate_divider;
-            }
-        }
-
-        frame_data.get_frame_table(frame_counter, frame_table);
-
-        if (frame_data.config.v_repeat != dvi0.vertical_repeat) {
-            printf("Changing v repeat to %d\n", frame_data.config.v_repeat);
-            // Wait until it is safe to change the vertical repeat
-            while (dvi0.timing_state.v_state == DVI_STATE_ACTIVE)
-                __compiler_memory_barrier();
-            dvi0.vertical_repeat = frame_data.config.v_repeat;
-        }
-
-        setup_palette();
-
-        update_sprites();
-
-        // Update offsets
-        for (int i = 1; i < NUM_SCROLL_OFFSETS; ++i) {
-            frame_data_address_offset[i] = next_frame_data_address_offset[i];
-        }
-
-        // Read first 2 lines
-        line_counter = 0;
-        read_two_lines(0);
-        ram.wait_for_finish_blocking();
-        line_counter = 2;
+        // If the headers are bad a blank frame is output and they are read again next VSYNC,
+        // so the DVI output keeps running while the RAM contents are fixed.
+        const bool frame_valid = setup_frame(vsync_start_time);
 
         diags.peak_scanline_time = std::max(diags.peak_scanline_time, std::max(diags.scanline_max_prep_time[0], diags.scanline_max_prep_time[1]));
         diags.vsync_time = time_us_32() - vsync_start_time;
@@ -258,10 +317,14 @@ void DisplayDriver::run() {
         printf("VSYNC %luus, late: %d\n", diags.vsync_time, dvi0.total_late_scanlines);
 #endif
 
+        diags.ram_traffic = ram.get_traffic();
+        ram.clear_traffic();
+
         if (diags_callback) {
             diags.total_late_scanlines = dvi0.total_late_scanlines;
             diags_callback(diags);
         }
+        profile::end_frame();
 
         // Clear per frame diags
         diags.scanline_total_prep_time[0] = 0;
@@ -271,7 +334,8 @@ void DisplayDriver::run() {
         diags.scanline_max_sprites[0] = 0;
         diags.scanline_max_sprites[1] = 0;
 
-        main_loop();
+        if (frame_valid) main_loop();
+        else output_blank_frame();
 
         gpio_put(PIN_VSYNC, 0);
 
@@ -335,6 +399,167 @@ void DisplayDriver::run() {
     }
 }
 
+bool DisplayDriver::setup_frame(uint32_t vsync_start_time) {
+    if (spi_mode) {
+        ram.set_qpi();
+    }
+
+    bool headers_changed = true;
+    if (frame_data.has_valid_headers()) {
+        // Assume the headers are unchanged, so the frame table and palette can be
+        // fetched along with them.  If they have changed, everything is read again.
+        const int prev_frame_counter = frame_counter;
+        const int prev_frames_to_next_count = frames_to_next_count;
+        const uint8_t prev_last_bank = last_bank;
+
+        update_frame_counter();
+        const int read_frame_counter = frame_counter;
+        headers_changed = !frame_data.read_frame(frame_counter, frame_table, line_scroll, line_palette, palettes);
+
+        if (headers_changed) {
+            frame_counter = prev_frame_counter;
+            frames_to_next_count = prev_frames_to_next_count;
+            last_bank = prev_last_bank;
+        }
+        else if (frame_data.frame_table_header.bank_number != last_bank) {
+            // A bank switch restarts from the new bank's first frame, the layout is unchanged
+            // so only the frame's own tables need reading again if that is a different frame.
+            update_frame_counter();
+            if (frame_counter != read_frame_counter) {
+                frame_data.get_frame_table(frame_counter, frame_table, line_scroll, line_palette);
+                if (frame_data.frame_table_header.num_palettes != 0 && frame_data.frame_table_header.palette_advance) {
+                    frame_data.get_palettes(frame_counter, palettes);
+                    ram.wait_for_finish_blocking();
+                }
+            }
+        }
+    }
+
+    if (headers_changed) {
+        // The frame must also fit the buffers allocated for the resolution
+        if (!frame_data.read_headers() ||
+            frame_data.config.h_length > frame_width ||
+            frame_data.config.v_length > frame_height ||
+            frame_data.frame_table_header.frame_table_length > MAX_FRAME_HEIGHT ||
+            frame_data.frame_table_header.num_palettes > MAX_PALETTES) {
+            ++diags.total_bad_headers;
+            frame_data.invalidate_headers();
+            return false;
+        }
+        //printf("%hdx%hd\n", frame_data.config.h_length, frame_data.config.v_length);
+
+        update_frame_counter();
+
+        frame_data.get_frame_table(frame_counter, frame_table, line_scroll, line_palette);
+        if (frame_data.frame_table_header.num_palettes != 0) {
+            frame_data.get_palettes(frame_counter, palettes);
+            ram.wait_for_finish_blocking();
+        }
+    }
+
+    decode_frame_table();
+    setup_tmds_luts();
+
+    if (frame_data.config.v_repeat != dvi0.vertical_repeat) {
+        printf("Changing v repeat to %d\n", frame_data.config.v_repeat);
+        // Wait until it is safe to change the vertical repeat
+        while (dvi0.timing_state.v_state == DVI_STATE_ACTIVE)
+            __compiler_memory_barrier();
+        dvi0.vertical_repeat = frame_data.config.v_repeat;
+    }
+
+    // Start the sprite reads, the palette LUTs are built while the line tables are read
+    uint32_t zone_start = profile::begin();
+    load_sprites(vsync_start_time);
+    profile::end(profile::ZONE_SPRITE_LOAD, zone_start);
+
+    zone_start = profile::begin();
+    setup_palette();
+    profile::end(profile::ZONE_LUT_BUILD, zone_start);
+
+    zone_start = profile::begin();
+    setup_sprite_patches();
+    setup_sprite_assignments(vsync_start_time);
+    profile::end(profile::ZONE_SPRITE_LOAD, zone_start);
+
+    // Update offsets
+    for (int i = 1; i < NUM_SCROLL_OFFSETS; ++i) {
+        frame_data_address_offset[i] = next_frame_data_address_offset[i];
+    }
+
+    // Read first 2 lines
+    line_counter = 0;
+    read_two_lines(0);
+    zone_start = profile::begin();
+    ram.wait_for_read(last_line_read[0]);
+    profile::end(profile::ZONE_PSRAM_WAIT, zone_start);
+    line_counter = 2;
+
+    return true;
+}
+
+void DisplayDriver::decode_frame_table() {
+    // Lines are read in pairs, so an odd final line is followed by one more
+    const uint32_t num_lines = (frame_data.config.v_length + 1) & ~1;
+
+    has_fullres_palette_lines = false;
+    has_fullres_15bpp_lines = false;
+    for (uint32_t i = 0; i < num_lines; ++i) {
+        const FrameTableEntry entry = frame_table[i];
+        const uint32_t pixel_data_len = get_pixel_data_len(entry.line_mode());
+
+        uint32_t addr = entry.line_address();
+        if (frame_data.has_line_scroll()) addr += line_scroll[i] * (int)pixel_data_len;
+        line_address[i] = (entry.frame_offset_idx() << 30) | (addr & 0xFFFFFF);
+
+        int8_t lmode = 0;
+        uint32_t line_length = frame_data.config.h_length;
+        if (entry.h_repeat() == 2) {
+            lmode |= DOUBLE_PIXELS;
+            line_length >>= 1;
+        }
+        else if (entry.h_repeat() == 4) {
+            lmode |= QUAD_PIXELS;
+            line_length >>= 2;
+        }
+        if (entry.line_mode() == MODE_PALETTE) lmode |= PALETTE;
+        else if (entry.line_mode() == MODE_RGB888) lmode |= RGB888;
+
+        // Full resolution RGB888 lines are encoded as 15bpp
+        if ((lmode & (DOUBLE_PIXELS | QUAD_PIXELS)) == 0) {
+            if (lmode & PALETTE) has_fullres_palette_lines = true;
+            else has_fullres_15bpp_lines = true;
+        }
+
+        line_words[i] = (line_length * pixel_data_len + 3) >> 2;
+        line_modes[i] = lmode;
+
+        if (!frame_data.has_line_palette() || line_palette[i] >= frame_data.frame_table_header.num_palettes) {
+            line_palette[i] = 0;
+        }
+    }
+}
+
+void DisplayDriver::output_blank_frame() {
+    // Nothing is read from RAM this frame, so the RAM bank can be switched straight away
+    if (spi_mode) {
+        ram.set_spi();
+    }
+    gpio_put(PIN_VSYNC, 1);
+
+    // A black pixel doubled line is encoded into each TMDS buffer as it becomes free
+    uint32_t* const black_line = pixel_data[0];
+    memset(black_line, 0, frame_width);
+
+    const uint32_t num_lines = frame_height / dvi0.vertical_repeat;
+    for (uint32_t i = 0; i < num_lines; ++i) {
+        uint32_t* tmds_buf;
+        queue_remove_blocking_u32(&dvi0.q_tmds_free, &tmds_buf);
+        tmds_encode_15bpp(black_line, tmds_buf, frame_width >> 1);
+        queue_add_blocking_u32(&dvi0.q_tmds_valid, &tmds_buf);
+    }
+}
+
 void DisplayDriver::main_loop() {
     uint pixel_data_read_idx = 1;
     while (line_counter < frame_data.config.v_length + 2) {
@@ -343,7 +568,10 @@ void DisplayDriver::main_loop() {
             read_two_lines(pixel_data_read_idx);
         }
         else {
-            // We are done reading RAM, indicate RAM bank can be switched
+            // We are done reading RAM, indicate RAM bank can be switched.  A deferred sprite
+            // load still part way through is abandoned, and started again next frame.
+            ram.wait_for_finish_blocking();
+            deferred_load_stage = DEFERRED_IDLE;
             if (spi_mode) {
                 ram.set_spi();
             }
@@ -351,24 +579,37 @@ void DisplayDriver::main_loop() {
             gpio_put(PIN_VSYNC, 1);
         }
 
-        // Flip the buffer index to the one read last time, which is now ready to output
+        // Flip the buffer index to the one read last time, which is now ready to output.
+        // If it had too many sprite reads to start in one chain the rest follow now.
         pixel_data_read_idx ^= 1;
+        uint32_t zone_start = profile::begin();
+        ram.wait_for_read(last_line_read[pixel_data_read_idx]);
+        profile::end(profile::ZONE_PSRAM_WAIT, zone_start);
 
         uint32_t *core0_tmds_buf = nullptr, *core1_tmds_buf;
+        zone_start = profile::begin();
         queue_remove_blocking_u32(&dvi0.q_tmds_free, &core1_tmds_buf);
-        sio_hw->fifo_wr = (line_counter - 2) | (line_mode[pixel_data_read_idx * 2] << 24);
+        profile::end(profile::ZONE_TMDS_QUEUE_WAIT, zone_start);
+
+        zone_start = profile::begin();
+        sio_hw->fifo_wr = (line_counter - 2) | (line_modes[line_counter - 2] << 24);
         sio_hw->fifo_wr = uint32_t(pixel_ptr[pixel_data_read_idx * 2]);
         sio_hw->fifo_wr = uint32_t(core1_tmds_buf);
         __sev();
+        profile::end(profile::ZONE_FIFO_HANDOFF, zone_start);
 
         if (line_counter < frame_data.config.v_length + 1) {
             uint32_t* core0_colour_buf = pixel_ptr[pixel_data_read_idx * 2 + 1];
 
+            zone_start = profile::begin();
             queue_remove_blocking_u32(&dvi0.q_tmds_free, &core0_tmds_buf);
-            prepare_scanline_core0(line_counter - 1, core0_colour_buf, core0_tmds_buf, line_mode[pixel_data_read_idx * 2 + 1]);
+            profile::end(profile::ZONE_TMDS_QUEUE_WAIT, zone_start);
+            (this->*scanline_encoders.core[0][line_modes[line_counter - 1]])(line_counter - 1, core0_colour_buf, core0_tmds_buf);
         }
 
+        zone_start = profile::begin();
         multicore_fifo_pop_blocking();
+        profile::end(profile::ZONE_FIFO_HANDOFF, zone_start);
         queue_add_blocking_u32(&dvi0.q_tmds_valid, &core1_tmds_buf);
         if (line_counter < frame_data.config.v_length + 1) {
             queue_add_blocking_u32(&dvi0.q_tmds_valid, &core0_tmds_buf);
@@ -379,128 +620,450 @@ void DisplayDriver::main_loop() {
 }
 
 void DisplayDriver::set_sprite(int8_t i, int16_t idx, BlendMode mode, int16_t x, int16_t y) {
+    if (i >= num_sprites) return;
     sprites[i].set_sprite_table_idx(idx);
     sprites[i].set_blend_mode(mode);
     sprites[i].set_sprite_pos(x, y);
 }
 
 void DisplayDriver::move_sprite(int8_t i, int16_t x, int16_t y) {
+    if (i >= num_sprites) return;
     sprites[i].set_sprite_pos(x, y);
 }
 
 void DisplayDriver::clear_sprite(int8_t i) {
+    if (i >= num_sprites) return;
     sprites[i].set_sprite_table_idx(-1);
 }
 
+void DisplayDriver::set_sprite_assignment(int i, int8_t slot, int16_t table_idx, BlendMode mode, int16_t x, int16_t y) {
+    if (i >= MAX_SPRITE_ASSIGNMENTS) return;
+    sprite_assignments[i] = { slot, mode, table_idx, x, y };
+}
+
 void DisplayDriver::clear_late_scanlines() {
     dvi0.total_late_scanlines = 0;
 }
 
-void DisplayDriver::prepare_scanline_core0(int line_number, uint32_t* pixel_data, uint32_t* tmds_buf, int scanline_mode) {
-    uint32_t start = time_us_32();
+template<int core, bool byte_pixels>
+__always_inline int DisplayDriver::apply_patches(int line_number, uint32_t* pixel_data) {
+    int i = 0;
+    for (; i < MAX_PATCHES_PER_LINE; ++i) {
+        Sprite::BlendPatch& patch = patches[line_number][i];
+        if (!patch.len) break;
 
-    int i;
-    for (i = 0; i < MAX_PATCHES_PER_LINE; ++i) {
-        if (patches[line_number][i].data) {
-            if (scanline_mode & (RGB888 | PALETTE)) Sprite::apply_blend_patch_byte_x(patches[line_number][i], (uint8_t*)pixel_data);
-            else Sprite::apply_blend_patch_555_y(patches[line_number][i], (uint8_t*)pixel_data);
-            patches[line_number][i].data = nullptr;
+        if (patch.direct) {
+            if constexpr (core == 0) Sprite::apply_direct_patch_y(patch, (uint8_t*)pixel_data);
+            else Sprite::apply_direct_patch_x(patch, (uint8_t*)pixel_data);
+        }
+        else if (patch.dma) {
+            if constexpr (core == 0) Sprite::apply_dma_patch_y(patch, (uint8_t*)pixel_data);
+            else Sprite::apply_dma_patch_x(patch, (uint8_t*)pixel_data);
         }
         else {
-            break;
+            // Patches are applied in order, so one on top of an opaque patch waits for its copy
+            if (patch.overlapped) {
+                if constexpr (core == 0) Sprite::wait_for_patch_dma_y();
+                else Sprite::wait_for_patch_dma_x();
+            }
+
+            if constexpr (byte_pixels) {
+                if constexpr (core == 0) Sprite::apply_blend_patch_byte_y(patch, (uint8_t*)pixel_data);
+                else Sprite::apply_blend_patch_byte_x(patch, (uint8_t*)pixel_data);
+            }
+            else {
+                if constexpr (core == 0) Sprite::apply_blend_patch_555_y(patch, (uint8_t*)pixel_data);
+                else Sprite::apply_blend_patch_555_x(patch, (uint8_t*)pixel_data);
+            }
         }
+        patch.len = 0;
     }
-    if (scanline_mode & DOUBLE_PIXELS) {
-        if (scanline_mode & RGB888) tmds_encode_24bpp(pixel_data, tmds_buf, frame_data.config.h_length >> 1);
-        else if (scanline_mode & PALETTE) tmds_encode_palette_data(pixel_data, tmds_doubled_palette_lut, tmds_buf, frame_data.config.h_length >> 1, 2, 5);
-        else tmds_encode_15bpp(pixel_data, tmds_buf, frame_data.config.h_length >> 1);
-    }
-    else if (scanline_mode & PALETTE) tmds_encode_fullres_palette(pixel_data, tmds_palette_luts, tmds_buf, frame_data.config.h_length);
-    else tmds_encode_fullres_15bpp(pixel_data, tmds_15bpp_lut, tmds_buf, frame_data.config.h_length);
 
-    const uint32_t scanline_time = time_us_32() - start;
-    diags.scanline_max_prep_time[0] = std::max(scanline_time, diags.scanline_max_prep_time[0]);
-    diags.scanline_max_sprites[0] = std::max(uint32_t(i), diags.scanline_max_sprites[0]);
-    diags.scanline_total_prep_time[0] += scanline_time;
-}    
+    // The encode reads the whole line, so any copy still running must finish first
+    if constexpr (core == 0) Sprite::wait_for_patch_dma_y();
+    else Sprite::wait_for_patch_dma_x();
+    return i;
+}
+
+// The patch loops are hot, so each core's go in the scratch bank of the sprite blend functions it calls
+template<bool byte_pixels>
+int __scratch_y("sprite_blend") DisplayDriver::apply_patches_core0(int line_number, uint32_t* pixel_data) {
+    return apply_patches<0, byte_pixels>(line_number, pixel_data);
+}
 
-void DisplayDriver::prepare_scanline_core1(int line_number, uint32_t* pixel_data, uint32_t* tmds_buf, int scanline_mode) {
+template<bool byte_pixels>
+int __scratch_x("sprite_blend") DisplayDriver::apply_patches_core1(int line_number, uint32_t* pixel_data) {
+    return apply_patches<1, byte_pixels>(line_number, pixel_data);
+}
+
+template<int core, int mode>
+__always_inline void DisplayDriver::prepare_scanline(int line_number, uint32_t* pixel_data, uint32_t* tmds_buf) {
     uint32_t start = time_us_32();
 
-    int i;
-    for (i = 0; i < MAX_PATCHES_PER_LINE; ++i) {
-        if (patches[line_number][i].data) {
-            if (scanline_mode & (RGB888 | PALETTE)) Sprite::apply_blend_patch_byte_x(patches[line_number][i], (uint8_t*)pixel_data);
-            else Sprite::apply_blend_patch_555_x(patches[line_number][i], (uint8_t*)pixel_data);
-            patches[line_number][i].data = nullptr;
-        }
-        else {
-            break;
-        }
+    int i = 0;
+    uint32_t zone_start = profile::begin();
+    if constexpr ((mode & HAS_PATCHES) != 0) {
+        constexpr bool byte_pixels = (mode & (RGB888 | PALETTE)) != 0;
+        if constexpr (core == 0) i = apply_patches_core0<byte_pixels>(line_number, pixel_data);
+        else i = apply_patches_core1<byte_pixels>(line_number, pixel_data);
+        profile::end(profile::ZONE_PATCH_BLEND, zone_start);
+        zone_start = profile::begin();
     }
-    if (scanline_mode & DOUBLE_PIXELS) {
-        if (scanline_mode & RGB888) tmds_encode_24bpp(pixel_data, tmds_buf, frame_data.config.h_length >> 1);
-        else if (scanline_mode & PALETTE) tmds_encode_palette_data(pixel_data, tmds_doubled_palette_lut, tmds_buf, frame_data.config.h_length >> 1, 2, 5);
-        else tmds_encode_15bpp(pixel_data, tmds_buf, frame_data.config.h_length >> 1);
+
+    if constexpr ((mode & (DOUBLE_PIXELS | QUAD_PIXELS)) != 0) {
+        const uint32_t num_pixels = frame_data.config.h_length >> ((mode & QUAD_PIXELS) ? 2 : 1);
+        if constexpr ((mode & RGB888) != 0) tmds_encode_24bpp(pixel_data, tmds_buf, num_pixels);
+        else if constexpr ((mode & PALETTE) != 0) tmds_encode_palette_data(pixel_data, tmds_doubled_palette_luts[line_palette[line_number]], tmds_buf, num_pixels, 2, 5);
+        else tmds_encode_15bpp(pixel_data, tmds_buf, num_pixels);
+        if constexpr ((mode & QUAD_PIXELS) != 0) tmds_repeat_words(tmds_buf, num_pixels);
     }
-    else if (scanline_mode & PALETTE) tmds_encode_fullres_palette(pixel_data, tmds_palette_luts, tmds_buf, frame_data.config.h_length);
+    else if constexpr ((mode & PALETTE) != 0) tmds_encode_fullres_palette(pixel_data, tmds_palette_luts, tmds_buf, frame_data.config.h_length);
     else tmds_encode_fullres_15bpp(pixel_data, tmds_15bpp_lut, tmds_buf, frame_data.config.h_length);
+    profile::end(profile::ZONE_TMDS_ENCODE, zone_start);
 
     const uint32_t scanline_time = time_us_32() - start;
-    diags.scanline_max_prep_time[1] = std::max(scanline_time, diags.scanline_max_prep_time[1]);
-    diags.scanline_max_sprites[1] = std::max(uint32_t(i), diags.scanline_max_sprites[1]);
-    diags.scanline_total_prep_time[1] += scanline_time;
-}    
+    diags.scanline_max_prep_time[core] = std::max(scanline_time, diags.scanline_max_prep_time[core]);
+    diags.scanline_max_sprites[core] = std::max(uint32_t(i), diags.scanline_max_sprites[core]);
+    diags.scanline_total_prep_time[core] += scanline_time;
+}
+
+// The encoders for each mode are small, as the patch loops and TMDS encodes are called out of
+// line, so they go in main RAM to leave the scratch banks for the hot loops and stacks.
+template<int mode>
+void __not_in_flash("scanline") DisplayDriver::prepare_scanline_core0(int line_number, uint32_t* pixel_data, uint32_t* tmds_buf) {
+    prepare_scanline<0, mode>(line_number, pixel_data, tmds_buf);
+}
+
+template<int mode>
+void __not_in_flash("scanline") DisplayDriver::prepare_scanline_core1(int line_number, uint32_t* pixel_data, uint32_t* tmds_buf) {
+    prepare_scanline<1, mode>(line_number, pixel_data, tmds_buf);
+}
+
+constexpr int DisplayDriver::canonical_scanline_mode(int mode) {
+    // Fold the combinations decode_frame_table never produces onto ones it does,
+    // so that only those encoders are instantiated.
+    if ((mode & DOUBLE_PIXELS) && (mode & QUAD_PIXELS)) mode &= ~DOUBLE_PIXELS;
+    if ((mode & PALETTE) && (mode & RGB888)) mode &= ~PALETTE;
+
+    // RGB888 lines must be repeated, full resolution lines are encoded as 15bpp as before
+    if ((mode & RGB888) && !(mode & (DOUBLE_PIXELS | QUAD_PIXELS))) mode &= ~RGB888;
+    return mode;
+}
+
+template<int... modes>
+constexpr DisplayDriver::ScanlineEncoders DisplayDriver::make_scanline_encoders(std::integer_sequence<int, modes...>) {
+    return {{
+        { &DisplayDriver::prepare_scanline_core0<canonical_scanline_mode(modes)>... },
+        { &DisplayDriver::prepare_scanline_core1<canonical_scanline_mode(modes)>... },
+    }};
+}
+
+const DisplayDriver::ScanlineEncoders DisplayDriver::scanline_encoders = 
+    DisplayDriver::make_scanline_encoders(std::make_integer_sequence<int, NUM_SCANLINE_MODES>());
 
 void DisplayDriver::read_two_lines(uint idx) {
-    uint32_t addresses[2];
     uint32_t* ptr = pixel_data[idx];
+    uint32_t read_id;
 
     for (int i = 0; i < 2; ++i) {
-        FrameTableEntry& entry = frame_table[line_counter + i];
+        const uint32_t line = line_counter + i;
+        const uint32_t line_length = line_words[line];
         uint32_t extra_line_length = 0;
-        uint32_t addr = entry.line_address() + frame_data_address_offset[entry.frame_offset_idx()];
+        uint32_t addr = (line_address[line] & 0xFFFFFF) + frame_data_address_offset[line_address[line] >> 30];
+
+        // The per line scroll may leave the address unaligned, the read places the first
+        // pixel at the start of the line buffer so the encoders don't need to know.
+        uint32_t* const read_ptr = ptr;
         if ((addr & 0x3FF) == 0x3FF) {
             addr -= 4;
             ++extra_line_length;
             ++ptr;
         }
-        addresses[i] = addr;
         pixel_ptr[idx * 2 + i] = ptr;
 
-        const bool double_pixels = (entry.h_repeat() == 2);
-        uint32_t line_length = frame_data.config.h_length * get_pixel_data_len(entry.line_mode());
-        if (double_pixels) line_length >>= 3;
-        else line_length >>= 2;
         ptr += line_length;
-        line_lengths[i] = line_length + extra_line_length;
-        
-        int8_t lmode = 0;
-        if (double_pixels) lmode |= DOUBLE_PIXELS;
-        if (entry.line_mode() == MODE_PALETTE) lmode |= PALETTE;
-        else if (entry.line_mode() == MODE_RGB888) lmode |= RGB888;
-        line_mode[idx * 2 + i] = lmode;
+        read_id = ram.queue_read(addr, read_ptr, line_length + extra_line_length, RAM_LINE_DATA);
+    }
+
+    // The sprite reads follow the line reads in the chain, so opaque sprites read straight
+    // into the line buffer land over the background.
+    for (int i = 0; i < 2; ++i) {
+        if (!(line_modes[line_counter + i] & HAS_PATCHES)) continue;
+
+        uint8_t* const line_ptr = (uint8_t*)pixel_ptr[idx * 2 + i];
+        uint32_t* sprite_buffer = sprite_data[idx * 2 + i];
+        for (auto& patch : patches[line_counter + i]) {
+            if (!patch.len) break;
+            read_id = Sprite::queue_patch_reads(ram, patch, line_ptr, sprite_buffer);
+        }
     }
 
-    ram.multi_read(addresses, line_lengths, 2, pixel_data[idx]);
+    // Sprites that didn't fit in VSYNC are read after the lines, so they don't hold them up
+    if (num_deferred_sprites != 0) queue_deferred_sprite_reads();
+
+    ram.submit_reads();
+    last_line_read[idx] = read_id;
+}
+
+void DisplayDriver::update_frame_counter() {
+    if (frame_data.frame_table_header.bank_number != last_bank) {
+        frame_counter = frame_data.frame_table_header.first_frame;
+        last_bank = frame_data.frame_table_header.bank_number;
+        frames_to_next_count = frame_data.frame_table_header.frame_rate_divider;
+    }
+    else if (frame_data.frame_table_header.frame_rate_divider != 0)
+    {
+        if (--frames_to_next_count <= 0) {
+            if (++frame_counter >= frame_data.frame_table_header.num_frames) {
+                frame_counter = 0;
+            }
+            frames_to_next_count = frame_data.frame_table_header.frame_rate_divider;
+        }
+    }
+}
+
+void DisplayDriver::setup_tmds_luts() {
+    const bool needed = has_fullres_palette_lines || has_fullres_15bpp_lines;
+    if (needed && !tmds_palette_luts) {
+        // The LUTs overwrite the line tables of the last sprite slots, which aren't shown
+        // until the LUTs are released and then load their line tables again.
+        for (int i = num_sprites_with_luts; i < num_sprites; ++i) {
+            sprites[i].clear_cached_data();
+        }
+        num_active_sprites = num_sprites_with_luts;
+        tmds_palette_luts = tmds_lut_space;
+        tmds_15bpp_lut = tmds_lut_space + (PALETTE_SIZE * PALETTE_SIZE * 2);
+    }
+    else if (!needed && tmds_palette_luts) {
+        num_active_sprites = num_sprites;
+        tmds_palette_luts = nullptr;
+        tmds_15bpp_lut = nullptr;
+        tmds_15bpp_lut_valid = false;
+    }
+
+    // The 15bpp LUT is fixed so only needs building once it is first used.
+    // The palette LUT is built by setup_palette.
+    if (has_fullres_15bpp_lines && !tmds_15bpp_lut_valid) {
+        tmds_double_encode_setup_default_lut(tmds_15bpp_lut);
+        memcpy(tmds_15bpp_lut + (PALETTE_SIZE * PALETTE_SIZE * 4), tmds_15bpp_lut, PALETTE_SIZE * PALETTE_SIZE * 2);
+        memcpy(tmds_15bpp_lut + (PALETTE_SIZE * PALETTE_SIZE * 8), tmds_15bpp_lut, PALETTE_SIZE * PALETTE_SIZE * 2);
+        tmds_15bpp_lut_valid = true;
+    }
 }
 
 void DisplayDriver::setup_palette() {
     if (frame_data.frame_table_header.num_palettes == 0) return;
 
-    uint8_t palette[PALETTE_SIZE * 3];
-    frame_data.get_palette(0, frame_counter, palette);
-    ram.wait_for_finish_blocking();
+    // Only palette 0 has the large full resolution LUT, the others are only used by repeated lines
+    if (has_fullres_palette_lines) {
+        tmds_double_encode_setup_lut(palettes[0], tmds_palette_luts, 3);
+        tmds_double_encode_setup_lut(palettes[0] + 1, tmds_palette_luts + (PALETTE_SIZE * PALETTE_SIZE * 4), 3);
+        tmds_double_encode_setup_lut(palettes[0] + 2, tmds_palette_luts + (PALETTE_SIZE * PALETTE_SIZE * 8), 3);
+    }
+    for (int i = 0; i < frame_data.frame_table_header.num_palettes; ++i) {
+        tmds_setup_palette_symbols(palettes[i], tmds_doubled_palette_luts[i], PALETTE_SIZE);
+    }
+}
+
+int32_t DisplayDriver::get_sprite_load_time_us(uint32_t line_table_len_in_words) {
+    const auto& calibration = ram.get_calibration();
+    const uint32_t mb_per_s = (calibration.selected_option >= 0) ? calibration.mb_per_s[calibration.selected_option] : DEFAULT_RAM_MB_PER_S;
+    return (line_table_len_in_words * 4) / mb_per_s + SPRITE_LOAD_OVERHEAD_US;
+}
+
+void DisplayDriver::load_sprites(uint32_t vsync_start_time) {
+    const uint8_t bank = frame_data.frame_table_header.bank_number;
+    int32_t budget_us = (int32_t)diags.available_vsync_time - (int32_t)(time_us_32() - vsync_start_time) - VSYNC_RESERVE_US;
+
+    // Load as many sprites as fit in the VSYNC time.  The rest reuse the line table from
+    // a previous frame if possible, or are deferred to be loaded during main_loop.
+    // Sprites that can't be on screen are skipped without reading anything.
+    int num_loading = 0;
+    num_deferred_sprites = 0;
+    deferred_load_stage = DEFERRED_IDLE;
+    for (int i = 0; i < num_active_sprites; ++i) {
+        Sprite& sprite = sprites[i];
+        if (!sprite.is_enabled()) {
+            sprite.set_load_state(Sprite::LOAD_NONE);
+            continue;
+        }
+
+        if (!sprite.may_be_on_screen(bank, frame_data.config.h_length, frame_data.config.v_length)) {
+            sprite.set_load_state(Sprite::LOAD_CULLED);
+            continue;
+        }
+
+        const int32_t load_time_us = get_sprite_load_time_us(sprite.get_line_table_len_in_words(bank));
+        if (load_time_us <= budget_us) {
+            budget_us -= load_time_us;
+            sprite.set_load_state(Sprite::LOAD_NOW);
+            ++num_loading;
+        }
+        else if (sprite.has_cached_data(bank)) {
+            sprite.set_load_state(Sprite::LOAD_CACHED);
+        }
+        else {
+            sprite.set_load_state(Sprite::LOAD_DEFERRED);
+            ++num_deferred_sprites;
+        }
+    }
 
-    tmds_double_encode_setup_lut(palette, tmds_palette_luts, 3);
-    tmds_double_encode_setup_lut(palette + 1, tmds_palette_luts + (PALETTE_SIZE * PALETTE_SIZE * 4), 3);
-    tmds_double_encode_setup_lut(palette + 2, tmds_palette_luts + (PALETTE_SIZE * PALETTE_SIZE * 8), 3);
-    tmds_setup_palette_symbols(palette, tmds_doubled_palette_lut, PALETTE_SIZE);
+    if (num_loading == 0) return;
+
+    // Each stage's reads are issued as one chain, the sprite table entries give the sprite
+    // addresses and the sizes there how much of each line table to read.  The sprite pixels
+    // are read with the scanlines.
+    uint32_t read_id = 0;
+    for (int i = 0; i < num_active_sprites; ++i) {
+        if (sprites[i].get_load_state() == Sprite::LOAD_NOW) {
+            read_id = sprites[i].queue_header_read(frame_data);
+        }
+    }
+    ram.submit_reads();
+    ram.wait_for_read(read_id);
+
+    for (int i = 0; i < num_active_sprites; ++i) {
+        if (sprites[i].get_load_state() == Sprite::LOAD_NOW) {
+            read_id = sprites[i].queue_size_read(frame_data);
+        }
+    }
+    ram.submit_reads();
+    ram.wait_for_read(read_id);
+
+    // The sizes are the actual sprite sizes, so cull again before reading the line tables
+    for (int i = 0; i < num_active_sprites; ++i) {
+        if (sprites[i].get_load_state() == Sprite::LOAD_NOW) {
+            sprites[i].decode_size();
+            if (sprites[i].is_on_screen(frame_data.config.h_length, frame_data.config.v_length)) {
+                sprite_line_table_reads[i] = sprites[i].queue_line_table_read(frame_data);
+            }
+            else {
+                sprites[i].set_load_state(Sprite::LOAD_CULLED);
+            }
+        }
+    }
+    ram.submit_reads();
 }
 
-void DisplayDriver::update_sprites() {
-    for (int i = 0; i < MAX_SPRITES; ++i) {
-        sprites[i].update_sprite(frame_data);
+void DisplayDriver::setup_sprite_patches() {
+    // Decode each line table as it arrives
+    for (int i = 0; i < num_active_sprites; ++i) {
+        if (sprites[i].get_load_state() == Sprite::LOAD_NOW) {
+            ram.wait_for_read(sprite_line_table_reads[i]);
+            sprites[i].decode_line_table(frame_data);
+        }
         sprites[i].setup_patches(*this);
     }
+}
+
+void DisplayDriver::setup_sprite_assignments(uint32_t vsync_start_time) {
+    // The assigned sprites are loaded in the same stages as load_sprites, a batch at a time into
+    // the line buffers, so the slots' own line tables are kept.  Each line table is only needed
+    // until its patches are set up.  Loads stop once the VSYNC time runs out.
+    const int h_length = frame_data.config.h_length;
+    const int v_length = frame_data.config.v_length;
+    const int32_t load_time_us = get_sprite_load_time_us(FrameDecode::SPRITE_LINE_TABLE_MAX_WORDS);
+    constexpr uint32_t line_table_words = Sprite::LINE_TABLE_BYTES / sizeof(uint32_t);
+
+    int i = 0;
+    bool out_of_time = false;
+    while (i < num_sprite_assignments && !out_of_time) {
+        int32_t budget_us = (int32_t)diags.available_vsync_time - (int32_t)(time_us_32() - vsync_start_time) - VSYNC_RESERVE_US;
+        int num_loads = 0;
+        for (; i < num_sprite_assignments && num_loads < assignment_loads_per_batch; ++i) {
+            const SpriteAssignment assignment = sprite_assignments[i];
+            if (assignment.slot < 0 || assignment.slot >= num_active_sprites || assignment.table_idx < 0) continue;
+            if (!Sprite::overlaps_frame(assignment.x, assignment.y, MAX_SPRITE_WIDTH, MAX_SPRITE_HEIGHT, h_length, v_length)) continue;
+
+            if (load_time_us > budget_us) {
+                out_of_time = true;
+                break;
+            }
+            budget_us -= load_time_us;
+
+            AssignmentLoad& load = assignment_loads[num_loads++];
+            load.assignment = assignment;
+            load.read = frame_data.queue_sprite_table_entry_read(assignment.table_idx, &load.header);
+        }
+        if (num_loads == 0) break;
+
+        ram.submit_reads();
+        ram.wait_for_read(assignment_loads[num_loads - 1].read);
+
+        for (int j = 0; j < num_loads; ++j) {
+            AssignmentLoad& load = assignment_loads[j];
+            load.read = frame_data.queue_sprite_size_read(load.header, &load.size_data);
+        }
+        ram.submit_reads();
+        ram.wait_for_read(assignment_loads[num_loads - 1].read);
+
+        for (int j = 0; j < num_loads; ++j) {
+            AssignmentLoad& load = assignment_loads[j];
+            FrameDecode::decode_sprite_size(load.header, load.size_data);
+            load.on_screen = Sprite::overlaps_frame(load.assignment.x, load.assignment.y, load.header.width, load.header.height, h_length, v_length);
+            if (load.on_screen) {
+                load.read = frame_data.queue_sprite_line_table_read(load.header, assignment_line_tables + j * line_table_words);
+            }
+        }
+        ram.submit_reads();
+
+        // The raw line table is half the size of the decoded one, so is decoded in place
+        for (int j = 0; j < num_loads; ++j) {
+            AssignmentLoad& load = assignment_loads[j];
+            if (!load.on_screen) continue;
+
+            ram.wait_for_read(load.read);
+            SpriteLine* lines = (SpriteLine*)(assignment_line_tables + j * line_table_words);
+            frame_data.decode_sprite_line_table(load.header, (uint32_t*)lines, lines);
+            Sprite::setup_patches(*this, load.header, lines, load.assignment.mode, load.assignment.x, load.assignment.y);
+        }
+    }
+}
+
+void DisplayDriver::queue_deferred_sprite_reads() {
+    // Each stage of the load is queued once the previous stage's read has completed, so
+    // this never waits for RAM.  The reads go in the chain with the next line pair.
+    if (deferred_load_stage != DEFERRED_IDLE && !ram.is_read_complete(deferred_load_read)) return;
+
+    Sprite& sprite = sprites[deferred_load_sprite];
+    switch (deferred_load_stage) {
+        case DEFERRED_IDLE:
+            for (deferred_load_sprite = 0; deferred_load_sprite < num_active_sprites; ++deferred_load_sprite) {
+                if (sprites[deferred_load_sprite].get_load_state() == Sprite::LOAD_DEFERRED) break;
+            }
+            if (deferred_load_sprite == num_active_sprites) {
+                num_deferred_sprites = 0;
+                return;
+            }
+
+            // The line table is overwritten, so it isn't valid until the load completes
+            sprites[deferred_load_sprite].clear_cached_data();
+            deferred_load_read = sprites[deferred_load_sprite].queue_header_read(frame_data);
+            deferred_load_stage = DEFERRED_HEADER;
+            break;
+
+        case DEFERRED_HEADER:
+            deferred_load_read = sprite.queue_size_read(frame_data);
+            deferred_load_stage = DEFERRED_SIZE;
+            break;
+
+        case DEFERRED_SIZE:
+            sprite.decode_size();
+            if (!sprite.is_on_screen(frame_data.config.h_length, frame_data.config.v_length)) {
+                sprite.set_load_state(Sprite::LOAD_CULLED);
+                --num_deferred_sprites;
+                deferred_load_stage = DEFERRED_IDLE;
+                break;
+            }
+            deferred_load_read = sprite.queue_line_table_read(frame_data);
+            deferred_load_stage = DEFERRED_LINE_TABLE;
+            break;
+
+        case DEFERRED_LINE_TABLE:
+            sprite.decode_line_table(frame_data);
+            sprite.set_load_state(Sprite::LOAD_CACHED);
+            --num_deferred_sprites;
+            deferred_load_stage = DEFERRED_IDLE;
+            break;
+    }
 }
\ No newline at end of file
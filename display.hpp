@@ -1,6 +1,8 @@
 #pragma once
 
 #include <map>
+#include <utility>
+#include <algorithm>
 
 #include "pico/sem.h"
 #include "aps6404.hpp"
@@ -18,12 +20,20 @@ class DisplayDriver
 public:
     DisplayDriver(PIO pio = pio1);
 
-    // May only be called before init
+    // May only be called before init.  libdvi can't release the PIO state machines, DMA channels
+    // and IRQs claimed by dvi_init, so changing the resolution once running needs a restart,
+    // see restart_with_settings in main.cpp.
     bool set_res(pico_stick::Resolution res);
     pico_stick::Resolution get_res() const { return current_res; }
+    static bool is_supported_res(pico_stick::Resolution res) { return get_timing(res) != nullptr; }
 
+    // Allocates the buffers for the current resolution and sets up DVI
     void init();
 
+    // Resources available at the current resolution, valid after init
+    int get_num_sprites() const { return num_sprites; }
+    int get_num_tmds_buffers() const { return num_tmds_buffers; }
+
     // Runs the display.  This never returns and also starts processing on core1.
     // The resolution and hence timing are specified in the PSRAM
     // so this sets up/resets the DVI appropriately as they change.
@@ -38,6 +48,13 @@ public:
     // Disbale a sprite
     void clear_sprite(int8_t i);
 
+    // Reuse sprite slot i to show a further sprite, for example lower down the frame.  The
+    // assignments are set up in order after the slots' own sprites each VSYNC, loading each
+    // sprite's line table into the line buffers while they are free, so they cost VSYNC time
+    // but no more SRAM.  Assignments that don't fit in the VSYNC time are not shown.
+    void set_sprite_assignment(int i, int8_t slot, int16_t table_idx, pico_stick::BlendMode mode, int16_t x, int16_t y);
+    void set_num_sprite_assignments(int num) { num_sprite_assignments = std::min(num, MAX_SPRITE_ASSIGNMENTS); }
+
     void set_frame_data_address_offset(int idx, int offset) {
         next_frame_data_address_offset[idx] = offset;
     }
@@ -51,6 +68,9 @@ public:
     void run_core1();
 
     pimoroni::APS6404 &get_ram() { return ram; }
+
+    // Calibrate the RAM read timing at the current clock, must be called before run()
+    void calibrate_ram();
     uint32_t get_clock_khz() { return dvi0.timing->bit_clk_khz; }
 
     // Diagnostic data - all times in us.
@@ -64,6 +84,8 @@ public:
         uint32_t available_total_scanline_time = 0;
         uint32_t available_time_per_scanline = 0;
         uint32_t available_vsync_time = 0;
+        uint32_t total_bad_headers = 0;  // Frames output blank because the RAM headers were invalid
+        pimoroni::APS6404::Traffic ram_traffic = {};  // PSRAM reads for the last frame, by RamConsumer
     };
     const Diags& get_diags() const { return diags; }
     void clear_peak_scanline_time() { diags.peak_scanline_time = 0; }
@@ -80,19 +102,48 @@ public:
 private:
     friend class Sprite;
 
+    static const dvi_timing* get_timing(pico_stick::Resolution res);
+
     enum ScanlineMode {
         DOUBLE_PIXELS = 1,
         PALETTE = 2,
         RGB888 = 4,
+        QUAD_PIXELS = 8,
+        HAS_PATCHES = 16,
     };
+    static constexpr int NUM_SCANLINE_MODES = 32;
 
+    // Scanline encoders specialised for each combination of ScanlineMode flags, so the
+    // line mode is only looked at once per line, to index the table for the core.
+    typedef void (DisplayDriver::*ScanlineEncoder)(int line_number, uint32_t* pixel_data, uint32_t* tmds_buf);
+    struct ScanlineEncoders {
+        ScanlineEncoder core[2][NUM_SCANLINE_MODES];
+    };
+    static const ScanlineEncoders scanline_encoders;
+    static constexpr int canonical_scanline_mode(int mode);
+    template<int... modes> static constexpr ScanlineEncoders make_scanline_encoders(std::integer_sequence<int, modes...>);
+
+    void setup_arena();
+    bool setup_frame(uint32_t vsync_start_time);
+    void decode_frame_table();
+    void output_blank_frame();
     void main_loop();
-    void prepare_scanline_core0(int line_number, uint32_t *pixel_data, uint32_t *tmds_buf, int scanline_mode);
-    void prepare_scanline_core1(int line_number, uint32_t *pixel_data, uint32_t *tmds_buf, int scanline_mode);
+    template<int core, int mode> void prepare_scanline(int line_number, uint32_t *pixel_data, uint32_t *tmds_buf);
+    template<int core, bool byte_pixels> int apply_patches(int line_number, uint32_t *pixel_data);
+    template<bool byte_pixels> int apply_patches_core0(int line_number, uint32_t *pixel_data);
+    template<bool byte_pixels> int apply_patches_core1(int line_number, uint32_t *pixel_data);
+    template<int mode> void prepare_scanline_core0(int line_number, uint32_t *pixel_data, uint32_t *tmds_buf);
+    template<int mode> void prepare_scanline_core1(int line_number, uint32_t *pixel_data, uint32_t *tmds_buf);
     void read_two_lines(uint idx);
+    void update_frame_counter();
+    void setup_tmds_luts();
     void setup_palette();
     void clear_patches();
-    void update_sprites();
+    void load_sprites(uint32_t vsync_start_time);
+    void setup_sprite_patches();
+    void queue_deferred_sprite_reads();
+    void setup_sprite_assignments(uint32_t vsync_start_time);
+    int32_t get_sprite_load_time_us(uint32_t line_table_len_in_words);
 
     FrameDecode frame_data;
     pico_stick::Resolution current_res;
@@ -112,26 +163,110 @@ private:
     // Must be as long as the greatest supported frame height.
     pico_stick::FrameTableEntry* frame_table;
 
-    // Patches that require blending, done by CPU
-    Sprite::BlendPatch patches[MAX_FRAME_HEIGHT][MAX_PATCHES_PER_LINE];
+    // Per line scroll offsets in pixels, only valid if frame_data.has_line_scroll()
+    alignas(4) int16_t line_scroll[MAX_FRAME_HEIGHT];
 
-    // Must be long enough to accept two lines plus one padding word at maximum data length and maximum width
-    uint32_t pixel_data[NUM_LINE_BUFFERS / 2][((MAX_FRAME_WIDTH + 1) * 3) / 2];
-    uint32_t* pixel_ptr[NUM_LINE_BUFFERS];
-    uint32_t line_lengths[2];
-    int8_t line_mode[NUM_LINE_BUFFERS];
+    // Per line palette indices.  Read from RAM if frame_data.has_line_palette(), and checked
+    // or cleared by decode_frame_table, so the scanline encoders can use them directly.
+    alignas(4) uint8_t line_palette[MAX_FRAME_HEIGHT];
 
-    Sprite sprites[MAX_SPRITES];
+    // Palettes for the current frame, as read from RAM
+    alignas(4) uint8_t palettes[MAX_PALETTES][PALETTE_SIZE * 3];
+
+    // The buffers below are allocated from the arena by init(), sized for the resolution.
+    alignas(4) uint8_t arena[DISPLAY_ARENA_BYTES];
+    uint32_t frame_width;
+    uint32_t frame_height;
 
-    // Palette TMDS symbol look up tables
-    uint32_t tmds_palette_luts[PALETTE_SIZE * PALETTE_SIZE * 12];
-    uint32_t* tmds_15bpp_lut = &tmds_palette_luts[PALETTE_SIZE * PALETTE_SIZE * 2];
+    // Sprite patches for each line, read from RAM with the line
+    Sprite::BlendPatch (*patches)[MAX_PATCHES_PER_LINE];
 
-    // Pixel doubling TMDS LUT
-    uint32_t tmds_doubled_palette_lut[PALETTE_SIZE * 3];
+    // The frame table decoded each frame by decode_frame_table, so the scanline loop only indexes it.
+    // Addresses include the line scroll, with the frame data offset index in the top 2 bits.
+    // Line modes are ScanlineMode flags, HAS_PATCHES is set by Sprite::setup_patches.
+    uint32_t* line_address;
+    uint16_t* line_words;
+    int8_t* line_modes;
 
-    // TMDS buffers.  Better to have them here than rely on dynamic allocation
-    uint32_t tmds_buffers[NUM_TMDS_BUFFERS * 3 * MAX_FRAME_WIDTH / DVI_SYMBOLS_PER_WORD];
+    // Must be long enough to accept two lines plus one padding word at maximum data length and frame width
+    uint32_t* pixel_data[NUM_LINE_BUFFERS / 2];
+    uint32_t line_buffer_words;
+    uint32_t* pixel_ptr[NUM_LINE_BUFFERS];
+
+    // Sprite pixels that must be blended by the CPU are read here alongside each line.
+    // Patches that don't fit are dropped, as for patches beyond MAX_PATCHES_PER_LINE.
+    uint32_t* sprite_data[NUM_LINE_BUFFERS];
+    uint32_t sprite_line_buffer_bytes;
+
+    // Last read for each pair of line buffers
+    uint32_t last_line_read[NUM_LINE_BUFFERS / 2];
+
+    // Only the first num_sprites have line tables allocated.  Only the first num_active_sprites
+    // are shown, as the later line tables are overwritten while the TMDS LUTs are allocated.
+    Sprite sprites[MAX_SPRITES];
+    int num_sprites = 0;
+    int num_active_sprites = 0;
+    int num_sprites_with_luts = 0;
+
+    // Sprites that didn't fit in the VSYNC time and are waiting to be loaded by main_loop.
+    // One is loaded at a time, a stage per line pair, see queue_deferred_sprite_reads.
+    int num_deferred_sprites = 0;
+    enum DeferredLoadStage {
+        DEFERRED_IDLE,
+        DEFERRED_HEADER,
+        DEFERRED_SIZE,
+        DEFERRED_LINE_TABLE,
+    };
+    DeferredLoadStage deferred_load_stage = DEFERRED_IDLE;
+    int deferred_load_sprite = 0;
+    uint32_t deferred_load_read;
+
+    // Line table reads started by load_sprites
+    uint32_t sprite_line_table_reads[MAX_SPRITES];
+
+    struct SpriteAssignment {
+        int8_t slot;
+        pico_stick::BlendMode mode;
+        int16_t table_idx;
+        int16_t x;
+        int16_t y;
+    };
+    SpriteAssignment sprite_assignments[MAX_SPRITE_ASSIGNMENTS];
+    int num_sprite_assignments = 0;
+
+    // Sprite assignments being loaded by setup_sprite_assignments.  Their line tables are
+    // read into the line buffers starting at assignment_line_tables, as many as fit.
+    static constexpr int MAX_ASSIGNMENT_LOADS = 16;
+    struct AssignmentLoad {
+        SpriteAssignment assignment;
+        pico_stick::SpriteHeader header;
+        uint32_t size_data;
+        uint32_t read;
+        bool on_screen;
+    };
+    AssignmentLoad assignment_loads[MAX_ASSIGNMENT_LOADS];
+    uint32_t* assignment_line_tables;
+    int assignment_loads_per_batch;
+
+    // Full resolution TMDS symbol look up tables, interleaved for each lane as libdvi expects.
+    // Allocated at the end of the arena by setup_tmds_luts while frames have full resolution
+    // lines, and nullptr otherwise.  Full resolution palette lines always use palette 0.
+    static constexpr uint32_t TMDS_LUT_WORDS = PALETTE_SIZE * PALETTE_SIZE * 12;
+    uint32_t* tmds_lut_space;
+    uint32_t* tmds_palette_luts = nullptr;
+    uint32_t* tmds_15bpp_lut = nullptr;
+    bool tmds_15bpp_lut_valid = false;
+
+    // Set by decode_frame_table when the frame has lines that need the LUTs above
+    bool has_fullres_palette_lines = false;
+    bool has_fullres_15bpp_lines = false;
+
+    // Pixel doubling TMDS LUTs, one per palette
+    uint32_t tmds_doubled_palette_luts[MAX_PALETTES][PALETTE_SIZE * 3];
+
+    // TMDS buffers.  Better to have them in the arena than rely on dynamic allocation
+    uint32_t* tmds_buffers[MAX_TMDS_BUFFERS];
+    int num_tmds_buffers = 0;
 
     Diags diags;
 
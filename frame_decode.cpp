@@ -13,69 +13,154 @@ namespace {
 bool FrameDecode::read_headers() {
     uint32_t buffer[headers_len_in_words];
 
-    ram.read_blocking(0, buffer, headers_len_in_words);
+    ram.read_blocking(0, buffer, headers_len_in_words, RAM_FRAME_TABLE);
 
     if (buffer[0] != 0x4F434950) {
-        // Magic word wrong.
-        printf("Magic word should be 0x4F434950, got %08lx\n", buffer[0]);
+        // Magic word wrong.  This is retried every frame, so only report it once.
+        if (headers_valid) printf("Magic word should be 0x4F434950, got %08lx\n", buffer[0]);
+        headers_valid = false;
         return false;
     }
 
     memcpy(&config, buffer + 1, sizeof(Config));
     memcpy(&frame_table_header, buffer + 1 + sizeof(Config) / 4, sizeof(FrameTableHeader));
+    headers_valid = true;
 
     return true;
 }
 
-void FrameDecode::get_frame_table(int frame_counter, FrameTableEntry* frame_table) {
-    uint32_t address = get_frame_table_address() + frame_counter * frame_table_header.frame_table_length;
+bool FrameDecode::read_frame(int frame_counter, FrameTableEntry* frame_table, int16_t* line_scroll, uint8_t* line_palette, uint8_t palettes[MAX_PALETTES][PALETTE_SIZE * 3]) {
+    uint32_t buffer[headers_len_in_words];
 
-    ram.read_blocking(address, (uint32_t*)frame_table, frame_table_header.frame_table_length);
+    // The layout is known from the previous headers, so everything can be fetched in one chain
+    uint32_t address = get_frame_table_address() + frame_counter * get_frame_table_stride();
+    uint32_t last_read = ram.queue_read(0, buffer, headers_len_in_words, RAM_FRAME_TABLE);
+    last_read = ram.queue_read(address, (uint32_t*)frame_table, frame_table_header.frame_table_length, RAM_FRAME_TABLE);
+    address += frame_table_header.frame_table_length * 4;
+    if (has_line_scroll()) {
+        last_read = ram.queue_read(address, (uint32_t*)line_scroll, get_line_scroll_len_in_words(), RAM_FRAME_TABLE);
+        address += get_line_scroll_len_in_words() * 4;
+    }
+    if (has_line_palette()) {
+        last_read = ram.queue_read(address, (uint32_t*)line_palette, get_line_palette_len_in_words(), RAM_FRAME_TABLE);
+    }
+    if (frame_table_header.num_palettes != 0 && frame_table_header.num_palettes <= MAX_PALETTES) {
+        last_read = ram.queue_read(get_palette_address(0, frame_counter), (uint32_t*)palettes, frame_table_header.num_palettes * (PALETTE_SIZE * 3) / 4, RAM_PALETTE);
+    }
+    ram.submit_reads();
+    ram.wait_for_read(last_read);
+
+    if (buffer[0] != 0x4F434950 || memcmp(&config, buffer + 1, sizeof(Config)) != 0) return false;
+
+    // Switching bank every frame is normal, and only changes where the frame counter starts
+    FrameTableHeader new_header;
+    memcpy(&new_header, buffer + 1 + sizeof(Config) / 4, sizeof(FrameTableHeader));
+    const uint8_t new_bank_number = new_header.bank_number;
+    const uint16_t new_first_frame = new_header.first_frame;
+    new_header.bank_number = frame_table_header.bank_number;
+    new_header.first_frame = frame_table_header.first_frame;
+    if (memcmp(&frame_table_header, &new_header, sizeof(FrameTableHeader)) != 0) return false;
+
+    frame_table_header.bank_number = new_bank_number;
+    frame_table_header.first_frame = new_first_frame;
+    return true;
 }
 
-void FrameDecode::get_palette(int idx, int frame_counter, uint8_t palette[PALETTE_SIZE * 3]) {
-    uint32_t address = get_palette_table_address() + (idx + frame_table_header.num_palettes * (frame_table_header.palette_advance ? frame_counter : 0)) * PALETTE_SIZE * 3;
+void FrameDecode::get_frame_table(int frame_counter, FrameTableEntry* frame_table, int16_t* line_scroll, uint8_t* line_palette) {
+    uint32_t address = get_frame_table_address() + frame_counter * get_frame_table_stride();
+
+    ram.read_blocking(address, (uint32_t*)frame_table, frame_table_header.frame_table_length, RAM_FRAME_TABLE);
+    address += frame_table_header.frame_table_length * 4;
 
-    ram.read(address, (uint32_t*)palette, (PALETTE_SIZE * 3) / 4);
+    if (has_line_scroll()) {
+        ram.read_blocking(address, (uint32_t*)line_scroll, get_line_scroll_len_in_words(), RAM_FRAME_TABLE);
+        address += get_line_scroll_len_in_words() * 4;
+    }
+
+    if (has_line_palette()) {
+        ram.read_blocking(address, (uint32_t*)line_palette, get_line_palette_len_in_words(), RAM_FRAME_TABLE);
+    }
+}
+
+void FrameDecode::get_palettes(int frame_counter, uint8_t palettes[MAX_PALETTES][PALETTE_SIZE * 3]) {
+    ram.read(get_palette_address(0, frame_counter), (uint32_t*)palettes, frame_table_header.num_palettes * (PALETTE_SIZE * 3) / 4, RAM_PALETTE);
 }
 
 void FrameDecode::get_sprite_header(int idx, pico_stick::SpriteHeader* sprite_header) {
     uint32_t address = get_sprite_table_address() + idx * 4;
 
-    ram.read_blocking(address, (uint32_t*)sprite_header, 1);
+    ram.read_blocking(address, (uint32_t*)sprite_header, 1, RAM_SPRITE_HEADERS);
+
+    uint32_t size_data;
+    ram.read_blocking(sprite_header->sprite_address(), &size_data, 1, RAM_SPRITE_HEADERS);
+    decode_sprite_size(*sprite_header, size_data);
+}
+
+void FrameDecode::get_sprite(const pico_stick::SpriteHeader& sprite_header, pico_stick::SpriteLine* sprite_line_table) {
+    // The raw line table is half the size of the decoded one, so is read into it and decoded in place
+    ram.read_blocking(sprite_header.sprite_address(), (uint32_t*)sprite_line_table, get_sprite_line_table_len_in_words(sprite_header.height), RAM_SPRITE_HEADERS);
+
+    SpriteHeader header = sprite_header;
+    decode_sprite_line_table(header, (uint32_t*)sprite_line_table, sprite_line_table);
+}
 
-    uint32_t header_data;
-    ram.read_blocking(sprite_header->sprite_address(), &header_data, 1);
-    uint8_t* header_ptr = (uint8_t*)&header_data;
-    sprite_header->width = header_ptr[0];
-    sprite_header->height = header_ptr[1];
+uint32_t FrameDecode::queue_sprite_table_entry_read(int idx, pico_stick::SpriteHeader* sprite_header) {
+    return ram.queue_read(get_sprite_table_address() + idx * 4, &sprite_header->hdr, 1, RAM_SPRITE_HEADERS);
 }
 
-void FrameDecode::get_sprite(int idx, const pico_stick::SpriteHeader& sprite_header, pico_stick::SpriteLine* sprite_line_table, uint32_t* sprite_data) {
-    uint32_t address = sprite_header.sprite_address();
+uint32_t FrameDecode::queue_sprite_size_read(const pico_stick::SpriteHeader& sprite_header, uint32_t* size_data) {
+    return ram.queue_read(sprite_header.sprite_address(), size_data, 1, RAM_SPRITE_HEADERS);
+}
 
-    assert(sprite_header.height <= MAX_SPRITE_HEIGHT);
-    ram.read_blocking(address, buffer, (sprite_header.height >> 1) + 1);
+uint32_t FrameDecode::queue_sprite_line_table_read(const pico_stick::SpriteHeader& sprite_header, uint32_t* buffer) {
+    return ram.queue_read(sprite_header.sprite_address(), buffer, get_sprite_line_table_len_in_words(sprite_header.height), RAM_SPRITE_HEADERS);
+}
+
+uint32_t FrameDecode::decode_sprite_line_table(pico_stick::SpriteHeader& sprite_header, const uint32_t* buffer, pico_stick::SpriteLine* sprite_line_table) {
+    const uint8_t* ptr = (const uint8_t*)buffer;
+    sprite_header.width = ptr[0];
+    sprite_header.height = ptr[1];
+    ptr += 2;
+
+    // Each decoded entry is twice the size of the raw one, so working from the last line
+    // down only ever overwrites raw entries that have already been decoded.
+    for (int y = sprite_header.height - 1; y >= 0; --y) {
+        const uint8_t offset = ptr[y * 2];
+        const uint8_t width = ptr[y * 2 + 1];
+        sprite_line_table[y].offset = offset;
+        sprite_line_table[y].width = width;
+    }
 
-    uint16_t total_length = 0;
-    uint8_t* ptr = (uint8_t*)buffer + 2;
-    for (uint8_t y = 0; y < sprite_header.height; ++y) {
-        sprite_line_table[y].data_start = total_length;
-        sprite_line_table[y].offset = *ptr++;
-        sprite_line_table[y].width = *ptr++;
-        total_length += sprite_line_table[y].width * get_pixel_data_len(sprite_header.sprite_mode());
+    uint16_t total_pixels = 0;
+    for (int y = 0; y < sprite_header.height; ++y) {
+        sprite_line_table[y].data_start = total_pixels;
+        total_pixels += sprite_line_table[y].width;
     }
 
-    address += 4 + 4 * (sprite_header.height >> 1);
-    ram.read(address, sprite_data, (total_length + 3) >> 2);
+    return total_pixels * get_pixel_data_len(sprite_header.sprite_mode());
 }
 
 uint32_t FrameDecode::get_frame_table_address() {
     return headers_len_in_bytes;
 }
 
+uint32_t FrameDecode::get_frame_table_stride() {
+    uint32_t stride = frame_table_header.frame_table_length * 4;
+    if (has_line_scroll()) {
+        stride += get_line_scroll_len_in_words() * 4;
+    }
+    if (has_line_palette()) {
+        stride += get_line_palette_len_in_words() * 4;
+    }
+    return stride;
+}
+
+uint32_t FrameDecode::get_palette_address(int idx, int frame_counter) {
+    return get_palette_table_address() + (idx + frame_table_header.num_palettes * (frame_table_header.palette_advance ? frame_counter : 0)) * PALETTE_SIZE * 3;
+}
+
 uint32_t FrameDecode::get_palette_table_address() {
-    return headers_len_in_bytes + frame_table_header.num_frames * frame_table_header.frame_table_length * 4;
+    return get_frame_table_address() + frame_table_header.num_frames * get_frame_table_stride();
 }
 
 uint32_t FrameDecode::get_sprite_table_address() {
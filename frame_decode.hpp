@@ -6,8 +6,6 @@
 
 class FrameDecode {
     public:    
-        static constexpr int MAX_SPRITE_HEIGHT = 64;
-
         FrameDecode(pimoroni::APS6404& aps6404)
             : ram(aps6404)
         {}
@@ -15,17 +13,65 @@ class FrameDecode {
         // Read the headers from PSRAM.  Returns false if PSRAM contents is invalid
         bool read_headers();
 
+        // Whether the last read_headers found valid headers
+        bool has_valid_headers() const { return headers_valid; }
+
+        // Mark the headers as invalid, if they are unusable for some other reason
+        void invalidate_headers() { headers_valid = false; }
+
+        // Read the headers, frame table, line scroll and palette tables and the palettes for the frame
+        // in a single RAM transaction, assuming the headers are unchanged since they were last read.
+        // Returns false if the headers have changed, in which case the headers must be read again,
+        // and the frame table and palette contents are invalid.  A change of bank number or first
+        // frame doesn't change the layout, so these are updated and true is returned, but the frame
+        // counter may then need resetting and the frame table and palette reading again.
+        bool read_frame(int frame_counter, pico_stick::FrameTableEntry* frame_table, int16_t* line_scroll, uint8_t* line_palette, uint8_t palettes[MAX_PALETTES][PALETTE_SIZE * 3]);
+
         // Fill the frame table from PSRAM, frame_table is an array of at least config.v_length
-        void get_frame_table(int frame_counter, pico_stick::FrameTableEntry* frame_table);
+        // If the frame has per line scroll offsets these are read into line_scroll, and per line palette
+        // indices into line_palette.  These must be the same length as the frame table and word aligned.
+        void get_frame_table(int frame_counter, pico_stick::FrameTableEntry* frame_table, int16_t* line_scroll, uint8_t* line_palette);
+
+        bool has_line_scroll() const { return config.flags & pico_stick::CONFIG_LINE_SCROLL; }
+        bool has_line_palette() const { return config.flags & pico_stick::CONFIG_LINE_PALETTE; }
 
-        // Fill a palette
-        void get_palette(int idx, int frame_counter, uint8_t palette[PALETTE_SIZE * 3]);
+        // Fill all the palettes for the frame, there must be no more than MAX_PALETTES
+        void get_palettes(int frame_counter, uint8_t palettes[MAX_PALETTES][PALETTE_SIZE * 3]);
 
         // Get a sprite header
         void get_sprite_header(int idx, pico_stick::SpriteHeader* sprite_header);
         
-        // Fill a sprite into appropriately sized buffer
-        void get_sprite(int idx, const pico_stick::SpriteHeader& sprite_header, pico_stick::SpriteLine* sprite_line_table, uint32_t* sprite_data);
+        // Fill the sprite line table, sprite_line_table must have room for MAX_SPRITE_HEIGHT lines.
+        // The sprite pixel data is left in RAM and read with the scanlines.
+        void get_sprite(const pico_stick::SpriteHeader& sprite_header, pico_stick::SpriteLine* sprite_line_table);
+
+        // Address of the sprite pixel data
+        static uint32_t get_sprite_data_address(const pico_stick::SpriteHeader& sprite_header) {
+            return sprite_header.sprite_address() + 4 + 4 * (sprite_header.height >> 1);
+        }
+
+        // Sprite loading split into stages, so that the reads for many sprites can be queued
+        // together on the RAM's scatter-gather reader.  The queue functions return the read id.
+        // The table entry gives the sprite's address, and the size word there how much of the
+        // line table to read.
+        static constexpr int SPRITE_LINE_TABLE_MAX_WORDS = (MAX_SPRITE_HEIGHT >> 1) + 1;
+        static uint32_t get_sprite_line_table_len_in_words(int height) { return (height >> 1) + 1; }
+        uint32_t queue_sprite_table_entry_read(int idx, pico_stick::SpriteHeader* sprite_header);
+
+        // Reads the sprite's size word into size_data, decode_sprite_size fills in the header from it
+        uint32_t queue_sprite_size_read(const pico_stick::SpriteHeader& sprite_header, uint32_t* size_data);
+        static void decode_sprite_size(pico_stick::SpriteHeader& sprite_header, uint32_t size_data) {
+            sprite_header.width = size_data & 0xFF;
+            sprite_header.height = (size_data >> 8) & 0xFF;
+        }
+
+        // Reads the sprite size and line table into buffer, the header's height must be set.
+        // buffer must be at least get_sprite_line_table_len_in_words(height) long.
+        uint32_t queue_sprite_line_table_read(const pico_stick::SpriteHeader& sprite_header, uint32_t* buffer);
+
+        // Decode the line table, filling in the width and height of the header.  Returns the sprite data length in bytes.
+        // The buffer may be the line table itself, so that it can be decoded in place.
+        uint32_t decode_sprite_line_table(pico_stick::SpriteHeader& sprite_header, const uint32_t* buffer, pico_stick::SpriteLine* sprite_line_table);
 
     public:
         pico_stick::Config config;
@@ -33,9 +79,13 @@ class FrameDecode {
 
     private:
         uint32_t get_frame_table_address();
+        uint32_t get_frame_table_stride();
+        uint32_t get_line_scroll_len_in_words() const { return (frame_table_header.frame_table_length + 1) >> 1; }
+        uint32_t get_line_palette_len_in_words() const { return (frame_table_header.frame_table_length + 3) >> 2; }
+        uint32_t get_palette_address(int idx, int frame_counter);
         uint32_t get_palette_table_address();
         uint32_t get_sprite_table_address();
 
         pimoroni::APS6404& ram;
-        uint32_t buffer[(MAX_SPRITE_HEIGHT >> 1) + 1];
+        bool headers_valid = false;
 };
@@ -0,0 +1,188 @@
+#include <cstring>
+#include "hdmi_packet.hpp"
+
+namespace {
+    // BCH parity is computed LSB first with the generator 1 + x^6 + x^7 + x^8, a byte at a time
+    struct ParityTable {
+        uint8_t table[256];
+
+        constexpr ParityTable() : table() {
+            for (int i = 0; i < 256; ++i) {
+                uint8_t ecc = i;
+                for (int bit = 0; bit < 8; ++bit) {
+                    ecc = (ecc >> 1) ^ ((ecc & 1) ? 0x83 : 0);
+                }
+                table[i] = ecc;
+            }
+        }
+    };
+    constexpr ParityTable parity_table;
+
+    uint8_t compute_bch(const uint8_t* data, int len) {
+        uint8_t ecc = 0;
+        for (int i = 0; i < len; ++i) {
+            ecc = parity_table.table[ecc ^ data[i]];
+        }
+        return ecc;
+    }
+
+    // TERC4 symbols for each 4-bit value, bit 0 is sent first
+    constexpr uint16_t terc4_symbols[16] = {
+        0b1010011100, 0b1001100011, 0b1011100100, 0b1011100010,
+        0b0101110001, 0b0100011110, 0b0110001110, 0b0100111100,
+        0b1011001100, 0b0100111001, 0b0110011100, 0b1011000110,
+        0b1010001110, 0b1001110001, 0b0101100011, 0b1011000011,
+    };
+    constexpr uint16_t GUARD_BAND_SYMBOL = 0b0100110011;
+
+    constexpr int CHANNEL_STATUS_FRAMES = 192;
+
+    uint8_t get_sample_rate_code(uint32_t sample_rate_hz) {
+        switch (sample_rate_hz) {
+            case 44100: return 0x0;
+            case 48000: return 0x2;
+            case 32000: return 0x3;
+            default:    return 0x1;  // Not indicated
+        }
+    }
+
+    // IEC 60958 channel status for consumer PCM, copying permitted, 16-bit samples
+    bool get_channel_status_bit(int frame_idx, uint32_t sample_rate_hz) {
+        uint8_t status;
+        switch (frame_idx >> 3) {
+            case 0: status = 0x04; break;
+            case 3: status = get_sample_rate_code(sample_rate_hz); break;
+            case 4: status = 0x02; break;
+            default: return false;
+        }
+        return (status >> (frame_idx & 7)) & 1;
+    }
+
+    void build_infoframe(hdmi::DataPacket& packet, uint8_t type, uint8_t version, const uint8_t* data, int len) {
+        memset(&packet, 0, sizeof(packet));
+        packet.header[0] = type;
+        packet.header[1] = version;
+        packet.header[2] = len;
+
+        // The packet bytes are spread 7 to a subpacket, starting with the checksum
+        uint8_t checksum = type + version + len;
+        for (int i = 0; i < len; ++i) {
+            packet.subpacket[(i + 1) / 7][(i + 1) % 7] = data[i];
+            checksum += data[i];
+        }
+        packet.subpacket[0][0] = -checksum;
+
+        packet.compute_parity();
+    }
+}
+
+namespace hdmi {
+    void DataPacket::compute_parity() {
+        header[3] = compute_bch(header, 3);
+        for (int i = 0; i < 4; ++i) {
+            subpacket[i][7] = compute_bch(subpacket[i], 7);
+        }
+    }
+
+    void build_audio_sample_packet(DataPacket& packet, const uint32_t* samples, int num_samples, int& frame_idx, uint32_t sample_rate_hz) {
+        memset(&packet, 0, sizeof(packet));
+        packet.header[0] = 0x02;
+        packet.header[1] = (1 << num_samples) - 1;  // Layout 0, with a flag for each sample present
+
+        for (int i = 0; i < num_samples; ++i) {
+            if (frame_idx == 0) packet.header[2] |= 0x10 << i;
+
+            // The 16-bit samples are the top of the 24-bit sample words
+            const uint16_t left = samples[i] & 0xFFFF;
+            const uint16_t right = samples[i] >> 16;
+            uint8_t* subpacket = packet.subpacket[i];
+            subpacket[1] = left & 0xFF;
+            subpacket[2] = left >> 8;
+            subpacket[4] = right & 0xFF;
+            subpacket[5] = right >> 8;
+
+            // Valid flags clear, no user data, then the channel status and even parity for each channel
+            const uint8_t status = get_channel_status_bit(frame_idx, sample_rate_hz) ? 1 : 0;
+            subpacket[6] = (status << 2) | ((__builtin_parity(left) ^ status) << 3) |
+                           (status << 6) | ((__builtin_parity(right) ^ status) << 7);
+
+            if (++frame_idx == CHANNEL_STATUS_FRAMES) frame_idx = 0;
+        }
+
+        packet.compute_parity();
+    }
+
+    void build_audio_clock_regeneration_packet(DataPacket& packet, uint32_t pixel_clock_khz, uint32_t sample_rate_hz) {
+        // Recommended N values, see HDMI 1.4 section 7.2
+        uint32_t n;
+        switch (sample_rate_hz) {
+            case 32000: n = 4096; break;
+            case 44100: n = 6272; break;
+            case 48000: n = 6144; break;
+            default:    n = (128 * sample_rate_hz) / 1000; break;
+        }
+        const uint32_t cts = (uint64_t(pixel_clock_khz) * 1000 * n) / (128ull * sample_rate_hz);
+
+        memset(&packet, 0, sizeof(packet));
+        packet.header[0] = 0x01;
+        for (int i = 0; i < 4; ++i) {
+            uint8_t* subpacket = packet.subpacket[i];
+            subpacket[1] = (cts >> 16) & 0xF;
+            subpacket[2] = (cts >> 8) & 0xFF;
+            subpacket[3] = cts & 0xFF;
+            subpacket[4] = (n >> 16) & 0xF;
+            subpacket[5] = (n >> 8) & 0xFF;
+            subpacket[6] = n & 0xFF;
+        }
+
+        packet.compute_parity();
+    }
+
+    void build_avi_infoframe(DataPacket& packet, uint8_t video_id_code) {
+        // RGB, active format same as the picture, no scan or bar info
+        const uint8_t data[13] = { 0x10, 0x08, 0x00, video_id_code };
+        build_infoframe(packet, 0x82, 2, data, sizeof(data));
+    }
+
+    void build_audio_infoframe(DataPacket& packet) {
+        // 2 channels, coding, rate and size given by the stream, front left and right speakers
+        const uint8_t data[10] = { 0x01 };
+        build_infoframe(packet, 0x84, 1, data, sizeof(data));
+    }
+
+    void encode_data_island(const DataPacket& packet, bool hsync, bool vsync, uint32_t lanes[3][ISLAND_WORDS]) {
+        const uint32_t sync = (hsync ? 1 : 0) | (vsync ? 2 : 0);
+
+        auto get_symbols = [&](int pixel, uint32_t* symbols) {
+            if (pixel < GUARD_BAND_PIXELS || pixel >= GUARD_BAND_PIXELS + PACKET_PIXELS) {
+                symbols[0] = terc4_symbols[0xC | sync];
+                symbols[1] = GUARD_BAND_SYMBOL;
+                symbols[2] = GUARD_BAND_SYMBOL;
+                return;
+            }
+
+            // Lane 0 carries a header bit per pixel, lanes 1 and 2 a pair of bits from each subpacket
+            const int i = pixel - GUARD_BAND_PIXELS;
+            const uint32_t header_bit = (packet.header[i >> 3] >> (i & 7)) & 1;
+            symbols[0] = terc4_symbols[sync | (header_bit << 2) | (i != 0 ? 8 : 0)];
+
+            uint32_t even_bits = 0, odd_bits = 0;
+            for (int j = 0; j < 4; ++j) {
+                const uint32_t bits = packet.subpacket[j][i >> 2] >> ((i & 3) * 2);
+                even_bits |= (bits & 1) << j;
+                odd_bits |= ((bits >> 1) & 1) << j;
+            }
+            symbols[1] = terc4_symbols[even_bits];
+            symbols[2] = terc4_symbols[odd_bits];
+        };
+
+        for (int i = 0; i < ISLAND_WORDS; ++i) {
+            uint32_t first[3], second[3];
+            get_symbols(i * 2, first);
+            get_symbols(i * 2 + 1, second);
+            for (int lane = 0; lane < 3; ++lane) {
+                lanes[lane][i] = first[lane] | (second[lane] << 10);
+            }
+        }
+    }
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <cstdint>
+
+// HDMI data island packets and their TMDS encoding.  This has no dependencies on the
+// Pico SDK, so that it can be built on a host and checked against reference packets.
+// It isn't part of the firmware yet, as libdvi has no way to send data islands in the
+// blanking periods.
+namespace hdmi {
+    struct DataPacket {
+        uint8_t header[4];        // 3 bytes followed by the BCH parity byte
+        uint8_t subpacket[4][8];  // 7 bytes followed by the BCH parity byte
+
+        // Fill in the parity bytes, must be called once the rest of the packet is set
+        void compute_parity();
+    };
+
+    // Audio sample packet for up to 4 stereo samples, each 16-bit left then right in one word.
+    // frame_idx is the IEC 60958 frame number of the first sample, and is advanced past the samples.
+    void build_audio_sample_packet(DataPacket& packet, const uint32_t* samples, int num_samples, int& frame_idx, uint32_t sample_rate_hz);
+
+    // Audio clock regeneration packet, giving the sink N and CTS for the sample rate
+    void build_audio_clock_regeneration_packet(DataPacket& packet, uint32_t pixel_clock_khz, uint32_t sample_rate_hz);
+
+    // InfoFrames describing RGB video and 2 channel PCM audio
+    void build_avi_infoframe(DataPacket& packet, uint8_t video_id_code);
+    void build_audio_infoframe(DataPacket& packet);
+
+    // A data island holding one packet between the leading and trailing guard bands.  The
+    // preamble before it is control symbols, sent by the blanking output as for sync.
+    constexpr int GUARD_BAND_PIXELS = 2;
+    constexpr int PACKET_PIXELS = 32;
+    constexpr int ISLAND_PIXELS = GUARD_BAND_PIXELS * 2 + PACKET_PIXELS;
+
+    // Each lane's symbols are packed two 10-bit symbols per word, first symbol in the low bits
+    constexpr int ISLAND_WORDS = ISLAND_PIXELS / 2;
+
+    // Encode a packet as a data island.  hsync and vsync are the sync levels during the island.
+    void encode_data_island(const DataPacket& packet, bool hsync, bool vsync, uint32_t lanes[3][ISLAND_WORDS]);
+}
@@ -7,6 +7,8 @@
 #include "constants.hpp"
 #include "pins.hpp"
 #include "edid.hpp"
+#include "i2c_interface.hpp"
+#include "profile.hpp"
 
 namespace {
     constexpr uint I2C_SLAVE_ADDRESS = 0x0d;
@@ -21,6 +23,17 @@ namespace {
     constexpr uint I2C_NUM_HIGH_REGS = 0x40;
     constexpr uint I2C_EDID_REGISTER = 0xED;
 
+    // Reads from this register stream the profile::ZoneStats for the last frame, as little endian words
+    constexpr uint I2C_PROFILE_REGISTER = 0xEE;
+    constexpr uint I2C_PROFILE_DATA_LEN = profile::NUM_ZONES * sizeof(profile::ZoneStats);
+
+    // Reads from this register stream the PSRAM traffic for the last frame, see i2c_slave_if::get_ram_traffic_table
+    constexpr uint I2C_RAM_TRAFFIC_REGISTER = 0xEB;
+
+    // Writes to this register stream a list of sprite slot assignments, see i2c_slave_if::init
+    constexpr uint I2C_SPRITE_ASSIGNMENT_REGISTER = 0xE8;
+    constexpr uint I2C_SPRITE_ASSIGNMENT_LEN = 8;
+
     // Callback made after an I2C write to high registers is complete.  It gives the first register written,
     // The last register written, and a pointer to the memory representing all high registers (from 0xC0).
     void (*i2c_reg_written_callback)(uint8_t, uint8_t, uint8_t*) = nullptr;
@@ -30,6 +43,10 @@ namespace {
     // holding all of the sprite info.
     void (*i2c_sprite_written_callback)(uint8_t, uint8_t, uint8_t*) = nullptr;
 
+    // Callback made after a list of sprite assignments is written.  It gives the number of
+    // assignments and a pointer to the memory holding them.
+    void (*i2c_sprite_assignment_callback)(uint8_t, uint8_t*) = nullptr;
+
     // To write a series of bytes, the master first
     // writes the memory address, followed by the data. The address is automatically incremented
     // for each byte transferred, looping back to 0 upon reaching the end. Reading is done
@@ -37,10 +54,13 @@ namespace {
     struct I2CContext
     {
         uint8_t sprite_mem[MAX_SPRITES * I2C_SPRITE_DATA_LEN];
+        uint8_t sprite_assignment_mem[MAX_SPRITE_ASSIGNMENTS * I2C_SPRITE_ASSIGNMENT_LEN];
         alignas(4) uint8_t high_regs[I2C_NUM_HIGH_REGS];
+        alignas(4) uint8_t ram_traffic[i2c_slave_if::I2C_RAM_TRAFFIC_LEN];
         uint16_t cur_register;
         uint8_t first_register;
-        uint8_t access_idx;
+        uint16_t access_idx;
+        const uint8_t* profile_data;
         bool got_register;
         bool data_written;
     } context __attribute__((section(".usb_ram.i2c_context")));
@@ -66,6 +86,12 @@ namespace {
                     ++cxt->cur_register;
                 }
                 cxt->data_written = true;
+            } else if (cxt->cur_register == I2C_SPRITE_ASSIGNMENT_REGISTER) {
+                const uint8_t data = i2c_read_byte(i2c);
+                if (cxt->access_idx < MAX_SPRITE_ASSIGNMENTS * I2C_SPRITE_ASSIGNMENT_LEN) {
+                    cxt->sprite_assignment_mem[cxt->access_idx++] = data;
+                }
+                cxt->data_written = true;
             } else if (cxt->cur_register >= I2C_HIGH_REG_BASE && cxt->cur_register < I2C_HIGH_REG_BASE + I2C_NUM_HIGH_REGS) {
                 cxt->high_regs[cxt->cur_register - I2C_HIGH_REG_BASE] = i2c_read_byte(i2c);
                 ++cxt->cur_register;
@@ -85,6 +111,14 @@ namespace {
             } else if (cxt->cur_register == I2C_EDID_REGISTER) {
                 i2c_write_byte(i2c, get_edid_data()[cxt->access_idx]);
                 if (++cxt->access_idx == 128) cxt->access_idx = 0;
+            } else if (cxt->cur_register == I2C_RAM_TRAFFIC_REGISTER) {
+                i2c_write_byte(i2c, cxt->ram_traffic[cxt->access_idx]);
+                if (++cxt->access_idx == i2c_slave_if::I2C_RAM_TRAFFIC_LEN) cxt->access_idx = 0;
+            } else if (cxt->cur_register == I2C_PROFILE_REGISTER) {
+                // Keep reading from the same frame's stats for the whole block
+                if (cxt->access_idx == 0) cxt->profile_data = (const uint8_t*)profile::get_frame_stats();
+                i2c_write_byte(i2c, cxt->profile_data[cxt->access_idx]);
+                if (++cxt->access_idx == I2C_PROFILE_DATA_LEN) cxt->access_idx = 0;
             } else if (cxt->cur_register >= I2C_HIGH_REG_BASE && cxt->cur_register < I2C_HIGH_REG_BASE + I2C_NUM_HIGH_REGS) {
                 i2c_write_byte(i2c, cxt->high_regs[cxt->cur_register - I2C_HIGH_REG_BASE]);
                 ++cxt->cur_register;
@@ -100,6 +134,10 @@ namespace {
                         if (cxt->access_idx == 0) cxt->cur_register--;
                         i2c_sprite_written_callback(cxt->first_register, std::min(cxt->cur_register, uint16_t(I2C_SPRITE_REG_BASE + MAX_SPRITES - 1)), cxt->sprite_mem);
                     }
+                } else if (cxt->first_register == I2C_SPRITE_ASSIGNMENT_REGISTER) {
+                    if (i2c_sprite_assignment_callback) {
+                        i2c_sprite_assignment_callback(cxt->access_idx / I2C_SPRITE_ASSIGNMENT_LEN, cxt->sprite_assignment_mem);
+                    }
                 } else if (cxt->first_register >= I2C_HIGH_REG_BASE && cxt->first_register < I2C_HIGH_REG_BASE + I2C_NUM_HIGH_REGS) {
                     if (i2c_reg_written_callback) {
                         i2c_reg_written_callback(cxt->first_register, std::min(cxt->cur_register-1, int(I2C_HIGH_REG_BASE + I2C_NUM_HIGH_REGS - 1)), cxt->high_regs);
@@ -118,12 +156,14 @@ namespace {
 }
 
 namespace i2c_slave_if {
-    uint8_t* init(void (*sprite_callback)(uint8_t, uint8_t, uint8_t*), void (*reg_callback)(uint8_t, uint8_t, uint8_t*)) {
+    uint8_t* init(void (*sprite_callback)(uint8_t, uint8_t, uint8_t*), void (*reg_callback)(uint8_t, uint8_t, uint8_t*), void (*sprite_assignment_callback)(uint8_t, uint8_t*)) {
         i2c_reg_written_callback = reg_callback;
         i2c_sprite_written_callback = sprite_callback;
+        i2c_sprite_assignment_callback = sprite_assignment_callback;
 
         memset(context.sprite_mem, 0xFF, MAX_SPRITES * I2C_SPRITE_DATA_LEN);
         memset(context.high_regs, 0, I2C_NUM_HIGH_REGS);
+        memset(context.ram_traffic, 0, i2c_slave_if::I2C_RAM_TRAFFIC_LEN);
 
         gpio_init(I2C_SLAVE_SDA_PIN);
         gpio_set_function(I2C_SLAVE_SDA_PIN, GPIO_FUNC_I2C);
@@ -151,4 +191,8 @@ namespace i2c_slave_if {
     uint8_t* get_high_reg_table() {
         return context.high_regs;
     }
+
+    uint8_t* get_ram_traffic_table() {
+        return context.ram_traffic;
+    }
 }
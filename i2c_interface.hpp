@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cstdint>
+#include "constants.hpp"
 
 // I2C slave interface
 namespace i2c_slave_if {
@@ -14,8 +15,15 @@ namespace i2c_slave_if {
     //  - First register written
     //  - Last register written (same as first if only one byte written)
     //  - Pointer start of high register memory (for all registers, the pointer points at register 0xC0)
+    // Writes to register 0xE8 stream a list of up to MAX_SPRITE_ASSIGNMENTS sprite assignments, which
+    // replaces the previous list.  Each is 8 bytes: the sprite slot, then the same 7 bytes as the sprite
+    // registers (blend mode, then little endian sprite table index, x and y).  An assignment to an
+    // unused slot, such as 0xFF, is ignored, so writing one clears the list.
+    // The sprite assignment callback arguments are:
+    //  - Number of assignments written
+    //  - Pointer to the start of the assignment list
     // The init call returns the pointer to high register memory, so that it can be properly initialized.
-    uint8_t* init(void (*sprite_callback)(uint8_t, uint8_t, uint8_t*), void (*reg_callback)(uint8_t, uint8_t, uint8_t*));
+    uint8_t* init(void (*sprite_callback)(uint8_t, uint8_t, uint8_t*), void (*reg_callback)(uint8_t, uint8_t, uint8_t*), void (*sprite_assignment_callback)(uint8_t, uint8_t*));
 
     // Deinitialize before adjusting clocks, then init again.
     void deinit();
@@ -25,4 +33,10 @@ namespace i2c_slave_if {
 
     // Get the high register memory, it is 64 bytes long and is 32-bit aligned
     uint8_t* get_high_reg_table();
+
+    // Get the memory read through the PSRAM traffic register, 0xEB.  It is 32-bit aligned and holds
+    // little endian words: the time reads were running in us, then for each RamConsumer the
+    // bytes read, commands issued and page splits.
+    static constexpr int I2C_RAM_TRAFFIC_LEN = 4 + NUM_RAM_CONSUMERS * 12;
+    uint8_t* get_ram_traffic_table();
 }
@@ -16,6 +16,7 @@
 #include "display.hpp"
 #include "aps6404.hpp"
 #include "edid.hpp"
+#include "profile.hpp"
 
 #include "pins.hpp"
 #include "constants.hpp"
@@ -24,6 +25,11 @@
 // from the entry point in RAM without trying to boot from flash.
 uint32_t __attribute__((section(".wd_data.boot"))) boot_args[4] = {0xb007c0d3, 0x6ff83f2c, 0x15004000, 0x20000001};
 
+// Watchdog scratch 0 holds this magic value, and scratch 1 the settings, when the firmware is
+// restarted to change resolution.  The firmware stays in RAM, so the restart takes only as long
+// as setting up the display again, and the display starts without waiting for register 0xFD.
+constexpr uint32_t RESTART_SETTINGS_MAGIC = 0x5e77c0d3;
+
 using namespace pimoroni;
 
 DisplayDriver display;
@@ -50,6 +56,14 @@ static uint8_t get_vreg_select_for_voltage(uint8_t voltage_50mv) {
 
 void setup_i2c_reg_data(uint8_t* regs);
 
+static void restart_with_settings(pico_stick::Resolution res, bool spi_mode, uint8_t voltage_50mv) {
+    printf("Restarting for resolution %d\n", res);
+    watchdog_hw->scratch[0] = RESTART_SETTINGS_MAGIC;
+    watchdog_hw->scratch[1] = res | (spi_mode ? 0x100 : 0) | (voltage_50mv << 16);
+    watchdog_reboot(0x20000001, 0x15004000, 0);
+    while (true);
+}
+
 void handle_i2c_reg_write(uint8_t reg, uint8_t end_reg, uint8_t* regs) {
     // Subtract 0xC0 from regs so that register numbers match addresses
     regs -= 0xC0;
@@ -91,6 +105,10 @@ void handle_i2c_reg_write(uint8_t reg, uint8_t end_reg, uint8_t* regs) {
         display.clear_late_scanlines();
     }
 
+    if (REG_WRITTEN(0xEC)) {
+        profile::set_enabled(regs[0xEC] != 0);
+    }
+
     if (REG_WRITTEN(0xEF)) {
         display.set_frame_counter(regs[0xEF]);
     }
@@ -106,10 +124,15 @@ void handle_i2c_reg_write(uint8_t reg, uint8_t end_reg, uint8_t* regs) {
         }
     }
     if (REG_WRITTEN(0xFC)) {
+        const pico_stick::Resolution res = (pico_stick::Resolution)regs[0xFC];
         if (regs[0xFD] == 0) { // If not started, can change mode
-            display.set_res((pico_stick::Resolution)regs[0xFC]);
+            display.set_res(res);
             setup_i2c_reg_data(regs + 0xC0);
         }
+        else if (res != display.get_res() && DisplayDriver::is_supported_res(res)) {
+            // Once started the display can only be set up again by restarting
+            restart_with_settings(res, regs[0xFE] != 0, regs[0xDE]);
+        }
         regs[0xFC] = display.get_res();
     }
     if (REG_WRITTEN(0xFE)) {
@@ -141,6 +164,18 @@ void handle_i2c_sprite_write(uint8_t sprite, uint8_t end_sprite, uint8_t* sprite
     }
 }
 
+void handle_i2c_sprite_assignment_write(uint8_t num_assignments, uint8_t* assignment_data) {
+    for (int i = 0; i < num_assignments; ++i) {
+        uint8_t* assignment_ptr = assignment_data + 8 * i;
+
+        int16_t sprite_idx = (int8_t(assignment_ptr[3]) << 8) | assignment_ptr[2];
+        int16_t x = (assignment_ptr[5] << 8) | assignment_ptr[4];
+        int16_t y = (assignment_ptr[7] << 8) | assignment_ptr[6];
+        display.set_sprite_assignment(i, assignment_ptr[0], sprite_idx, (pico_stick::BlendMode)assignment_ptr[1], x, y);
+    }
+    display.set_num_sprite_assignments(num_assignments);
+}
+
 void set_i2c_reg_data_for_frame(uint8_t* regs, const DisplayDriver::Diags& diags) {
     regs -= 0xC0;
 
@@ -156,10 +191,35 @@ void set_i2c_reg_data_for_frame(uint8_t* regs, const DisplayDriver::Diags& diags
     regs[0xD6] = (diags.total_late_scanlines) >> 16;
     regs[0xD7] = (diags.total_late_scanlines) >> 24;
     regs[0xD8] = std::max(diags.scanline_max_sprites[0], diags.scanline_max_sprites[1]);
+    regs[0xDF] = std::min((diags.ram_traffic.busy_us * 100) / (diags.available_vsync_time + diags.available_total_scanline_time), uint32_t(255));
+    regs[0xE6] = diags.total_bad_headers;
+    regs[0xE7] = diags.total_bad_headers >> 8;
+}
+
+void set_i2c_reg_data_for_ram_calibration(uint8_t* regs, const APS6404::Calibration& calibration) {
+    regs -= 0xC0;
+
+    regs[0xD9] = calibration.selected_option;
+    regs[0xDA] = calibration.selected_option >= 0 ? calibration.latency_adjust[calibration.selected_option] : 0;
+    for (int i = 0; i < APS6404::NUM_READ_PROGRAM_OPTIONS; ++i) {
+        regs[0xE0 + i] = calibration.mb_per_s[i];
+    }
+}
+
+void set_i2c_ram_traffic_data(uint8_t* data, const APS6404::Traffic& traffic) {
+    uint32_t* words = (uint32_t*)data;
+
+    *words++ = traffic.busy_us;
+    for (int i = 0; i < NUM_RAM_CONSUMERS; ++i) {
+        *words++ = traffic.consumers[i].bytes;
+        *words++ = traffic.consumers[i].commands;
+        *words++ = traffic.consumers[i].page_splits;
+    }
 }
 
 void handle_display_diags_callback(const DisplayDriver::Diags& diags) {
     set_i2c_reg_data_for_frame(i2c_slave_if::get_high_reg_table(), diags);
+    set_i2c_ram_traffic_data(i2c_slave_if::get_ram_traffic_table(), diags.ram_traffic);
 }
 
 void setup_i2c_reg_data(uint8_t* regs) {
@@ -213,13 +273,27 @@ int main() {
         pwm_set_gpio_level(PIN_LED, 0);
     }
 
-    uint8_t* regs = i2c_slave_if::init(handle_i2c_sprite_write, handle_i2c_reg_write);
+    uint8_t* regs = i2c_slave_if::init(handle_i2c_sprite_write, handle_i2c_reg_write, handle_i2c_sprite_assignment_write);
     setup_i2c_reg_data(regs);
     regs -= 0xC0;
     printf("DV Display Driver I2C Initialised\n");
 
     read_edid();
 
+    if (watchdog_hw->scratch[0] == RESTART_SETTINGS_MAGIC) {
+        // Restarted to change resolution, start straight away with the new settings
+        watchdog_hw->scratch[0] = 0;
+        const uint32_t settings = watchdog_hw->scratch[1];
+        display.set_res((pico_stick::Resolution)(settings & 0xFF));
+        display.set_spi_mode((settings & 0x100) != 0);
+        setup_i2c_reg_data(regs + 0xC0);
+
+        // Keep any raised voltage, but the new clock may need more
+        regs[0xDE] = std::max(regs[0xDE], uint8_t(settings >> 16));
+        regs[0xFE] = (settings & 0x100) ? 1 : 0;
+        regs[0xFD] = 1;
+    }
+
     // Wait for I2C to indicate we should start
     while (regs[0xFD] == 0) __wfe();
     display.init();
@@ -238,16 +312,18 @@ int main() {
 
 	stdio_init_all();
     display.get_ram().adjust_clock();
+    display.calibrate_ram();
 
     // Reinit I2C now clock is set.
-    i2c_slave_if::init(handle_i2c_sprite_write, handle_i2c_reg_write);
+    i2c_slave_if::init(handle_i2c_sprite_write, handle_i2c_reg_write, handle_i2c_sprite_assignment_write);
+    set_i2c_reg_data_for_ram_calibration(i2c_slave_if::get_high_reg_table(), display.get_ram().get_calibration());
+    i2c_slave_if::get_high_reg_table()[0xDB - 0xC0] = display.get_num_sprites();
 
     printf("DV Driver: Clock configured\n");
 
     display.run();
 
-    // If run ever exits, the magic number in the RAM was wrong.
-    // For now we reboot if that happens
+    // run should never exit, but reboot if it does
     printf("DV Driver: Display failed\n");
 
     printf("DV Driver: Resetting\n");
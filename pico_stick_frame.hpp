@@ -33,9 +33,14 @@ namespace pico_stick {
         BLEND_BLEND2 = 4,   // Use frame if Sprite A0, add if Sprite A1
     };
 
+    enum ConfigFlags : uint8_t {
+        CONFIG_LINE_SCROLL = 0x01,  // Each frame table is followed by a table of per line pixel scroll offsets
+        CONFIG_LINE_PALETTE = 0x02, // Each frame table is followed by a table of per line palette indices
+    };
+
     struct Config {
         Resolution res;
-        uint8_t unused;
+        uint8_t flags;
         uint8_t v_repeat;
         bool blank;
 
@@ -78,7 +83,7 @@ namespace pico_stick {
     struct SpriteLine {
         uint8_t offset;
         uint8_t width;
-        uint16_t data_start;  // Index into data of start of line
+        uint16_t data_start;  // Index of the first pixel of the line in the sprite data
     };
 
     inline uint32_t get_pixel_data_len(pico_stick::LineMode mode) {
@@ -0,0 +1,46 @@
+#include <cstring>
+#include <algorithm>
+#include "profile.hpp"
+
+namespace profile {
+    bool enabled = false;
+    ZoneStats current_stats[2][NUM_ZONES];
+
+    namespace {
+        // Double buffered so that an I2C read in progress sees a complete frame
+        ZoneStats frame_stats[2][NUM_ZONES];
+        int frame_stats_idx = 0;
+    }
+
+    void init_core() {
+        systick_hw->csr = 0;
+        systick_hw->rvr = 0xFFFFFF;
+        systick_hw->cvr = 0;
+
+        // Enable, clocked from the processor clock, no interrupt
+        systick_hw->csr = 0x5;
+    }
+
+    void set_enabled(bool enable) {
+        if (enable && !enabled) memset(current_stats, 0, sizeof(current_stats));
+        enabled = enable;
+    }
+
+    void end_frame() {
+        if (!enabled) return;
+
+        ZoneStats* stats = frame_stats[frame_stats_idx ^ 1];
+        for (int i = 0; i < NUM_ZONES; ++i) {
+            stats[i].total_cycles = current_stats[0][i].total_cycles + current_stats[1][i].total_cycles;
+            stats[i].max_cycles = std::max(current_stats[0][i].max_cycles, current_stats[1][i].max_cycles);
+            stats[i].count = current_stats[0][i].count + current_stats[1][i].count;
+        }
+        frame_stats_idx ^= 1;
+
+        memset(current_stats, 0, sizeof(current_stats));
+    }
+
+    const ZoneStats* get_frame_stats() {
+        return frame_stats[frame_stats_idx];
+    }
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <cstdint>
+#include "pico/platform.h"
+#include "hardware/structs/systick.h"
+
+// Profiling zones, timed in system clock cycles using each core's SysTick counter.
+// begin() is just a register read, and end() returns straight away unless enabled.
+namespace profile {
+    enum Zone {
+        ZONE_PSRAM_WAIT,        // Waiting for line reads to complete
+        ZONE_PATCH_BLEND,       // Applying sprite patches to lines
+        ZONE_TMDS_ENCODE,
+        ZONE_FIFO_HANDOFF,      // Passing lines to core 1 and waiting for it to finish them
+        ZONE_TMDS_QUEUE_WAIT,   // Waiting for a free TMDS buffer
+        ZONE_LUT_BUILD,         // Palette TMDS look up tables
+        ZONE_SPRITE_LOAD,       // Loading sprite line tables and setting up patches
+        NUM_ZONES
+    };
+
+    // Per frame stats for a zone, combined over both cores
+    struct ZoneStats {
+        uint32_t total_cycles;
+        uint32_t max_cycles;
+        uint32_t count;
+    };
+
+    // Start SysTick on the calling core, must be called on each core that records zones
+    void init_core();
+
+    void set_enabled(bool enable);
+
+    // Publish this frame's stats and start the next frame.
+    // Called on core 0 at the end of VSYNC, when core 1 is idle.
+    void end_frame();
+
+    // Stats for the last completed frame, NUM_ZONES entries
+    const ZoneStats* get_frame_stats();
+
+    extern bool enabled;
+    extern ZoneStats current_stats[2][NUM_ZONES];
+
+    inline uint32_t begin() {
+        return systick_hw->cvr;
+    }
+
+    inline void end(Zone zone, uint32_t start) {
+        if (!enabled) return;
+
+        // SysTick is a 24 bit down counter, so this is good for zones up to 2^24 cycles
+        const uint32_t cycles = (start - systick_hw->cvr) & 0xFFFFFF;
+        ZoneStats& stats = current_stats[get_core_num()][zone];
+        stats.total_cycles += cycles;
+        if (cycles > stats.max_cycles) stats.max_cycles = cycles;
+        ++stats.count;
+    }
+}
@@ -1,40 +1,91 @@
 #include <cstring>
 #include <cstdio>
+#include <algorithm>
 
 #include "sprite.hpp"
 #include "display.hpp"
 
 using namespace pico_stick;
 
-void Sprite::update_sprite(FrameDecode& frame_data) {
-    if (idx < 0) return;
+namespace {
+    // Shorter opaque patches are cheaper to copy than to split into separate reads
+    constexpr int MIN_DIRECT_PATCH_LEN = 16;
 
-    frame_data.get_sprite_header(idx, &header);
+    // Shorter opaque patches that can't be read direct are cheaper to copy on the CPU than by DMA
+    constexpr int MIN_DMA_PATCH_LEN = 32;
 
-    //printf("Setup sprite width %d, height %d\n", header.width, header.height);
-    frame_data.get_sprite(idx, header, lines, (uint32_t*)data);
+    // Whether an opaque patch can be read straight into the line buffer.  None of the
+    // reads may start on the last byte of a RAM page.
+    bool can_read_direct(uint32_t address, uint32_t start, uint32_t end) {
+        const uint32_t aligned_start = (start + 3) & ~3;
+        const uint32_t aligned_end = end & ~3;
+        if (((address + (aligned_start - start)) & 0x3FF) == 0x3FF) return false;
+        if (aligned_start != start && (address & 0x3FF) == 0x3FF) return false;
+        if (aligned_end != end && ((address + (aligned_end - start)) & 0x3FF) == 0x3FF) return false;
+        return true;
+    }
+}
+
+static_assert(FrameDecode::SPRITE_LINE_TABLE_MAX_WORDS * 4 <= Sprite::LINE_TABLE_BYTES, "Raw line table must fit in the decoded line table");
+
+uint32_t Sprite::queue_header_read(FrameDecode& frame_data) {
+    return frame_data.queue_sprite_table_entry_read(idx, &header);
+}
+
+uint32_t Sprite::queue_size_read(FrameDecode& frame_data) {
+    return frame_data.queue_sprite_size_read(header, &size_data);
+}
+
+void Sprite::decode_size() {
+    // The cached line table is no use if the size has changed
+    const uint8_t old_width = header.width;
+    const uint8_t old_height = header.height;
+    FrameDecode::decode_sprite_size(header, size_data);
+    if (header.width != old_width || header.height != old_height) loaded_idx = -1;
+}
+
+uint32_t Sprite::queue_line_table_read(FrameDecode& frame_data) {
+    return frame_data.queue_sprite_line_table_read(header, (uint32_t*)lines);
+}
+
+void Sprite::decode_line_table(FrameDecode& frame_data) {
+    frame_data.decode_sprite_line_table(header, (uint32_t*)lines, lines);
+
+    loaded_idx = idx;
+    loaded_bank = frame_data.frame_table_header.bank_number;
 }
 
 void Sprite::setup_patches(DisplayDriver& disp) {
-    if (idx < 0) return;
+    if (idx < 0 || load_state == LOAD_DEFERRED || load_state == LOAD_CULLED) return;
+
+    setup_patches(disp, header, lines, blend_mode, x, y);
+}
+
+void Sprite::setup_patches(DisplayDriver& disp, const SpriteHeader& header, const SpriteLine* lines, BlendMode blend_mode, int16_t x, int16_t y) {
+    const int pixel_size = get_pixel_data_len(header.sprite_mode());
+    const uint32_t data_address = FrameDecode::get_sprite_data_address(header);
+
+    // Only the sprite lines on screen
+    const int first_line = std::max(0, -int(y));
+    const int last_line = std::min(int(header.height), disp.frame_data.config.v_length - y);
 
-    for (int i = 0; i < header.height; ++i) {
+    for (int i = first_line; i < last_line; ++i) {
         const int line_idx = y + i;
-        if (line_idx < 0 || line_idx >= disp.frame_data.config.v_length) continue;
-        auto& line = lines[i];
+        const auto& line = lines[i];
         if (line.width == 0) continue;
         
         int start = x + line.offset;
         int end = start + line.width;
         int start_offset = 0;
         int line_len = disp.frame_data.config.h_length;
-        if (disp.frame_table[line_idx].h_repeat() == 2) line_len >>= 1;
+        const int8_t lmode = disp.line_modes[line_idx];
+        if (lmode & DisplayDriver::DOUBLE_PIXELS) line_len >>= 1;
+        else if (lmode & DisplayDriver::QUAD_PIXELS) line_len >>= 2;
 
         if (end <= 0) continue;
         if (start >= line_len) continue;
         if (end > line_len) end = line_len;
-        
-        const int pixel_size = get_pixel_data_len(header.sprite_mode());
+
         start *= pixel_size;
         end *= pixel_size;
         if (start < 0) {
@@ -43,26 +94,75 @@ void Sprite::setup_patches(DisplayDriver& disp) {
         }
 
         const int len = end - start;
-        uint8_t* const sprite_data_ptr = data + line.data_start + start_offset;
+        const uint32_t address = data_address + line.data_start * pixel_size + start_offset;
+
+        // Find a free patch, checking the space left in the line's sprite buffer and whether
+        // any earlier patch, which will be applied after the reads, overlaps this one.
         auto* patch = disp.patches[line_idx];
+        uint32_t buffer_used = 0;
+        bool overlapped = false;
         int j = 0;
-        for (; patch->data && j < MAX_PATCHES_PER_LINE; ++j) {
+        for (; patch->len && j < MAX_PATCHES_PER_LINE; ++j) {
+            buffer_used += get_patch_buffer_len(*patch);
+            if (patch->offset < end && start < patch->offset + patch->len) overlapped = true;
             ++patch;
         }
         if (j == MAX_PATCHES_PER_LINE) {
             continue;
         }
-        patch->data = sprite_data_ptr;
+
+        patch->address = address;
         patch->offset = start;
         patch->len = len;
         patch->mode = blend_mode;
+        patch->direct = (blend_mode == BLEND_NONE && !overlapped && len >= MIN_DIRECT_PATCH_LEN && can_read_direct(address, start, end));
+        patch->dma = (blend_mode == BLEND_NONE && !patch->direct && len >= MIN_DMA_PATCH_LEN);
+        patch->overlapped = overlapped;
+        if (buffer_used + get_patch_buffer_len(*patch) > disp.sprite_line_buffer_bytes) {
+            patch->len = 0;
+        }
+        else {
+            disp.line_modes[line_idx] |= DisplayDriver::HAS_PATCHES;
+        }
     }
 }
 
+uint32_t Sprite::queue_patch_reads(pimoroni::APS6404& ram, BlendPatch& patch, uint8_t* line_ptr, uint32_t*& buffer) {
+    uint32_t read_id;
+    patch.data = (uint8_t*)buffer;
+
+    if (patch.direct) {
+        const uint32_t start = (patch.offset + 3) & ~3;
+        const uint32_t end = (patch.offset + patch.len) & ~3;
+        read_id = ram.queue_read(patch.address + (start - patch.offset), (uint32_t*)(line_ptr + start), (end - start) >> 2, RAM_SPRITE_DATA);
+        if (start != patch.offset) {
+            read_id = ram.queue_read(patch.address, buffer, 1, RAM_SPRITE_DATA);
+        }
+        if (end != uint32_t(patch.offset + patch.len)) {
+            read_id = ram.queue_read(patch.address + (end - patch.offset), buffer + 1, 1, RAM_SPRITE_DATA);
+        }
+        buffer += 2;
+    }
+    else {
+        // Start the read early so the sprite pixels have the same alignment as the line, which
+        // keeps the blend word aligned.  A read can't start on the last byte of a RAM page.
+        uint32_t lead = patch.offset & 3;
+        uint32_t addr = patch.address - lead;
+        if ((addr & 0x3FF) == 0x3FF) {
+            addr -= 4;
+            lead += 4;
+        }
+        const uint32_t len_in_words = (lead + patch.len + 3) >> 2;
+        read_id = ram.queue_read(addr, buffer, len_in_words, RAM_SPRITE_DATA);
+        patch.data += lead;
+        buffer += len_in_words;
+    }
+
+    return read_id;
+}
+
 __scratch_x("sprite_buffer") int Sprite::dma_channel_x;
-__scratch_x("sprite_buffer") uint32_t Sprite::buffer_x[MAX_SPRITE_WIDTH / 2];
 __scratch_y("sprite_buffer") int Sprite::dma_channel_y;
-__scratch_y("sprite_buffer") uint32_t Sprite::buffer_y[MAX_SPRITE_WIDTH / 2];
 
 __always_inline static void blend_one_555(BlendMode mode, uint16_t* sprite_pixel_ptr, uint16_t* frame_pixel_ptr) {
     constexpr uint16_t alpha_mask = 0x8000;
@@ -103,31 +203,20 @@ __always_inline static void blend_one_555(BlendMode mode, uint16_t* sprite_pixel
     }
 }
 
-__always_inline static void apply_blend_patch_555(const Sprite::BlendPatch& patch, uint8_t* frame_pixel_data, uint32_t* sprite_buffer, int dma_channel) {
+__always_inline static void apply_blend_patch_555(const Sprite::BlendPatch& patch, uint8_t* frame_pixel_data) {
     uint16_t* sprite_pixel_ptr = (uint16_t*)patch.data;
     uint16_t* const sprite_end_ptr = (uint16_t*)(patch.data + patch.len);
     uint16_t* frame_pixel_ptr = (uint16_t*)((uint8_t*)frame_pixel_data + patch.offset);
 
-    // Align sprite_pixel_ptr
+    // Align sprite_pixel_ptr.  The sprite data was read with the same alignment as the
+    // line, so this aligns frame_pixel_ptr too, whatever the sprite's x position.
     if ((uintptr_t)sprite_pixel_ptr & 3) {
         blend_one_555(patch.mode, sprite_pixel_ptr++, frame_pixel_ptr++);
     }
 
     uint32_t* sprite_pixel_ptr32 = (uint32_t*)sprite_pixel_ptr;
     uint32_t* const sprite_end_ptr32 = (uint32_t*)((uintptr_t)sprite_end_ptr & ~3);
-    uint32_t* frame_pixel_ptr32;
-    bool dma_reqd;
-    if (((uintptr_t)frame_pixel_ptr & 3) && sprite_end_ptr32 > sprite_pixel_ptr32) {
-        dma_channel_wait_for_finish_blocking(dma_channel);
-        frame_pixel_ptr32 = sprite_buffer;
-        dma_channel_set_read_addr(dma_channel, frame_pixel_ptr, false);
-        dma_channel_transfer_to_buffer_now(dma_channel, sprite_buffer, (sprite_end_ptr32 - sprite_pixel_ptr32) << 1);
-        dma_reqd = true;
-    }
-    else {
-        frame_pixel_ptr32 = (uint32_t*)frame_pixel_ptr;
-        dma_reqd = false;
-    }
+    uint32_t* frame_pixel_ptr32 = (uint32_t*)frame_pixel_ptr;
 
     // Final pixel
     if ((uintptr_t)sprite_end_ptr & 3) {
@@ -247,59 +336,145 @@ __always_inline static void apply_blend_patch_555(const Sprite::BlendPatch& patc
             }
         }
     }
+}
 
-    if (dma_reqd) {
-        // DMA doing halfword transfers to fix up the misalignment.
-        dma_channel_set_read_addr(dma_channel, sprite_buffer, false);
-        dma_channel_transfer_to_buffer_now(dma_channel, frame_pixel_ptr, (frame_pixel_ptr32 - sprite_buffer) << 1);
+__always_inline static void blend_one_byte(BlendMode mode, const uint8_t* sprite_pixel_ptr, uint8_t* frame_pixel_ptr) {
+    constexpr uint8_t alpha_mask = 0x01;
+    switch (mode) {
+        case BLEND_DEPTH:
+        case BLEND_BLEND:
+            if ((*sprite_pixel_ptr & ~*frame_pixel_ptr) & alpha_mask) {
+                *frame_pixel_ptr = *sprite_pixel_ptr & (~alpha_mask);
+            }
+            break;
+        case BLEND_DEPTH2:
+        case BLEND_BLEND2:
+            if (*sprite_pixel_ptr & alpha_mask) {
+                *frame_pixel_ptr = *sprite_pixel_ptr;
+            }
+            break;
+        default:
+            *frame_pixel_ptr = *sprite_pixel_ptr;
+            break;
     }
 }
 
-__always_inline static void apply_blend_patch_byte(const Sprite::BlendPatch& patch, uint8_t* frame_pixel_data, uint32_t* sprite_buffer, int dma_channel) {
-    uint8_t* sprite_pixel_ptr = (uint8_t*)patch.data;
-    uint8_t* const sprite_end_ptr = (uint8_t*)(patch.data + patch.len);
-    uint8_t* frame_pixel_ptr = ((uint8_t*)frame_pixel_data + patch.offset);
-    constexpr uint8_t alpha_mask = 0x01;
+__always_inline static void apply_blend_patch_byte(const Sprite::BlendPatch& patch, uint8_t* frame_pixel_data) {
+    const uint8_t* sprite_pixel_ptr = patch.data;
+    const uint8_t* const sprite_end_ptr = patch.data + patch.len;
+    uint8_t* frame_pixel_ptr = frame_pixel_data + patch.offset;
 
+    // The sprite data was read with the same alignment as the line, so once the
+    // leading bytes are done both are word aligned and 4 pixels are blended at a time.
+    while (((uintptr_t)sprite_pixel_ptr & 3) && sprite_pixel_ptr < sprite_end_ptr) {
+        blend_one_byte(patch.mode, sprite_pixel_ptr++, frame_pixel_ptr++);
+    }
+
+    const uint32_t* sprite_pixel_ptr32 = (const uint32_t*)sprite_pixel_ptr;
+    const uint32_t* const sprite_end_ptr32 = (const uint32_t*)((uintptr_t)sprite_end_ptr & ~3);
+    uint32_t* frame_pixel_ptr32 = (uint32_t*)frame_pixel_ptr;
+
+    // Multiplying the alpha bits by 0xFF gives a mask of the bytes to take from the sprite
+    constexpr uint32_t alpha_mask = 0x01010101;
     switch (patch.mode) {
         case BLEND_DEPTH:
         case BLEND_BLEND:
-            for (; sprite_pixel_ptr < sprite_end_ptr; ++sprite_pixel_ptr, ++frame_pixel_ptr) {
-                if ((*sprite_pixel_ptr & ~*frame_pixel_ptr) & alpha_mask) {
-                    *frame_pixel_ptr = *sprite_pixel_ptr & (~alpha_mask);
-                }
+            for (; sprite_pixel_ptr32 < sprite_end_ptr32; ++sprite_pixel_ptr32, ++frame_pixel_ptr32) {
+                const uint32_t mask = ((*sprite_pixel_ptr32 & ~*frame_pixel_ptr32) & alpha_mask) * 0xFF;
+                *frame_pixel_ptr32 = (*frame_pixel_ptr32 & ~mask) | (*sprite_pixel_ptr32 & ~alpha_mask & mask);
             }
             break;
         case BLEND_DEPTH2:
         case BLEND_BLEND2:
-            for (; sprite_pixel_ptr < sprite_end_ptr; ++sprite_pixel_ptr, ++frame_pixel_ptr) {
-                if (*sprite_pixel_ptr & alpha_mask) {
-                    *frame_pixel_ptr = *sprite_pixel_ptr;
-                }
+            for (; sprite_pixel_ptr32 < sprite_end_ptr32; ++sprite_pixel_ptr32, ++frame_pixel_ptr32) {
+                const uint32_t mask = (*sprite_pixel_ptr32 & alpha_mask) * 0xFF;
+                *frame_pixel_ptr32 = (*frame_pixel_ptr32 & ~mask) | (*sprite_pixel_ptr32 & mask);
             }
             break;
         default:
-            while (sprite_pixel_ptr < sprite_end_ptr) {
-                *frame_pixel_ptr++ = *sprite_pixel_ptr++;
+            for (; sprite_pixel_ptr32 < sprite_end_ptr32; ++sprite_pixel_ptr32, ++frame_pixel_ptr32) {
+                *frame_pixel_ptr32 = *sprite_pixel_ptr32;
             }
             break;
     }
+
+    sprite_pixel_ptr = (const uint8_t*)sprite_pixel_ptr32;
+    frame_pixel_ptr = (uint8_t*)frame_pixel_ptr32;
+    while (sprite_pixel_ptr < sprite_end_ptr) {
+        blend_one_byte(patch.mode, sprite_pixel_ptr++, frame_pixel_ptr++);
+    }
 }
 
 void __scratch_x("sprite_blend") Sprite::apply_blend_patch_555_x(const BlendPatch& patch, uint8_t* frame_pixel_data) {
-    apply_blend_patch_555(patch, frame_pixel_data, buffer_x, dma_channel_x);
+    apply_blend_patch_555(patch, frame_pixel_data);
 }
 
 void __scratch_y("sprite_blend") Sprite::apply_blend_patch_555_y(const BlendPatch& patch, uint8_t* frame_pixel_data) {
-    apply_blend_patch_555(patch, frame_pixel_data, buffer_y, dma_channel_y);
+    apply_blend_patch_555(patch, frame_pixel_data);
 }
 
 void __scratch_x("sprite_blend") Sprite::apply_blend_patch_byte_x(const BlendPatch& patch, uint8_t* frame_pixel_data) {
-    apply_blend_patch_byte(patch, frame_pixel_data, buffer_x, dma_channel_x);
+    apply_blend_patch_byte(patch, frame_pixel_data);
 }
 
 void __scratch_y("sprite_blend") Sprite::apply_blend_patch_byte_y(const BlendPatch& patch, uint8_t* frame_pixel_data) {
-    apply_blend_patch_byte(patch, frame_pixel_data, buffer_y, dma_channel_y);
+    apply_blend_patch_byte(patch, frame_pixel_data);
+}
+
+__always_inline static void apply_direct_patch(const Sprite::BlendPatch& patch, uint8_t* frame_pixel_data) {
+    // Only the unaligned bytes at each end need copying, the rest was read straight into the line
+    const uint32_t patch_end = patch.offset + patch.len;
+    const uint32_t start = (patch.offset + 3) & ~3;
+    const uint32_t end = patch_end & ~3;
+
+    const uint8_t* sprite_pixel_ptr = patch.data;
+    for (uint32_t i = patch.offset; i < start; ++i) {
+        frame_pixel_data[i] = *sprite_pixel_ptr++;
+    }
+
+    sprite_pixel_ptr = patch.data + 4;
+    for (uint32_t i = end; i < patch_end; ++i) {
+        frame_pixel_data[i] = *sprite_pixel_ptr++;
+    }
+}
+
+void __scratch_x("sprite_blend") Sprite::apply_direct_patch_x(const BlendPatch& patch, uint8_t* frame_pixel_data) {
+    apply_direct_patch(patch, frame_pixel_data);
+}
+
+void __scratch_y("sprite_blend") Sprite::apply_direct_patch_y(const BlendPatch& patch, uint8_t* frame_pixel_data) {
+    apply_direct_patch(patch, frame_pixel_data);
+}
+
+__always_inline static void apply_dma_patch(const Sprite::BlendPatch& patch, uint8_t* frame_pixel_data, int dma_channel) {
+    // The sprite data has the same alignment as the line, so the whole words are copied by
+    // DMA and only the unaligned bytes at each end by the CPU.
+    const uint32_t patch_end = patch.offset + patch.len;
+    const uint32_t start = (patch.offset + 3) & ~3;
+    const uint32_t end = patch_end & ~3;
+
+    // This patch may overlap the previous DMA patch on the line
+    dma_channel_wait_for_finish_blocking(dma_channel);
+    dma_channel_set_read_addr(dma_channel, patch.data + (start - patch.offset), false);
+    dma_channel_transfer_to_buffer_now(dma_channel, frame_pixel_data + start, (end - start) >> 2);
+
+    const uint8_t* sprite_pixel_ptr = patch.data;
+    for (uint32_t i = patch.offset; i < start; ++i) {
+        frame_pixel_data[i] = *sprite_pixel_ptr++;
+    }
+
+    sprite_pixel_ptr = patch.data + (end - patch.offset);
+    for (uint32_t i = end; i < patch_end; ++i) {
+        frame_pixel_data[i] = *sprite_pixel_ptr++;
+    }
+}
+
+void __scratch_x("sprite_blend") Sprite::apply_dma_patch_x(const BlendPatch& patch, uint8_t* frame_pixel_data) {
+    apply_dma_patch(patch, frame_pixel_data, dma_channel_x);
+}
+
+void __scratch_y("sprite_blend") Sprite::apply_dma_patch_y(const BlendPatch& patch, uint8_t* frame_pixel_data) {
+    apply_dma_patch(patch, frame_pixel_data, dma_channel_y);
 }
 
 void Sprite::init() {
@@ -307,12 +482,12 @@ void Sprite::init() {
     dma_channel_x = dma_claim_unused_channel(true);
     dma_channel_y = dma_claim_unused_channel(true);
 
-    // Setup Sprite copying DMA channels - transfer halfwords from memory to memory
+    // Setup Sprite copying DMA channels - transfer words from memory to memory
     dma_channel_config c;
     c = dma_channel_get_default_config(dma_channel_x);
     channel_config_set_read_increment(&c, true);
     channel_config_set_write_increment(&c, true);
-    channel_config_set_transfer_data_size(&c, DMA_SIZE_16);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
     dma_channel_configure(
         dma_channel_x, &c,
         nullptr,
@@ -324,7 +499,7 @@ void Sprite::init() {
     c = dma_channel_get_default_config(dma_channel_y);
     channel_config_set_read_increment(&c, true);
     channel_config_set_write_increment(&c, true);
-    channel_config_set_transfer_data_size(&c, DMA_SIZE_16);
+    channel_config_set_transfer_data_size(&c, DMA_SIZE_32);
     dma_channel_configure(
         dma_channel_y, &c,
         nullptr,
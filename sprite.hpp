@@ -1,6 +1,7 @@
 #pragma once
 
 #include <vector>
+#include "hardware/dma.h"
 #include "constants.hpp"
 #include "frame_decode.hpp"
 
@@ -12,6 +13,10 @@ class Sprite {
 
         bool is_enabled() const { return idx >= 0; }
 
+        // Storage for the line table, which must be set before the sprite is used
+        static constexpr uint32_t LINE_TABLE_BYTES = MAX_SPRITE_HEIGHT * sizeof(pico_stick::SpriteLine);
+        void set_line_table(pico_stick::SpriteLine* line_table) { lines = line_table; }
+
         uint16_t get_sprite_table_idx() const { return idx; }
 
         void set_sprite_pos(int16_t new_x, int16_t new_y) {
@@ -33,19 +38,102 @@ class Sprite {
             uint32_t ctrl;    // Control word for DMA chain
         };
 
+        // Sprite pixels for one line.  The pixels are read from RAM along with the line,
+        // blended patches into the line's sprite buffer, aligned to match the destination.
+        // Direct patches are read straight into the line buffer, apart from any unaligned
+        // bytes at either end which are read to the first two words of the sprite buffer.
+        // Other opaque patches are copied by DMA, which runs while later patches are applied.
         struct BlendPatch {
-            uint8_t* data;
-            uint16_t offset; // in bytes
-            uint8_t len;     // in bytes
-            pico_stick::BlendMode mode;
+            uint8_t* data;          // Set when the line is read
+            uint32_t address : 24;  // Address of the sprite pixels in RAM
+            uint32_t direct : 1;
+            uint32_t dma : 1;
+            uint32_t overlapped : 1;  // Overlaps an earlier patch, so must wait for its DMA copy
+            pico_stick::BlendMode mode : 5;
+            uint16_t offset;        // in bytes
+            uint16_t len;           // in bytes, 0 if the patch is unused
+        };
+
+        // Sprite buffer space required by a patch, in bytes
+        static uint32_t get_patch_buffer_len(const BlendPatch& patch) {
+            // Blended patches may need up to 3 bytes of padding for alignment, and a
+            // further word if the read has to be started early, see queue_patch_reads.
+            if (patch.direct) return 8;
+            return (((patch.len + 6) >> 2) + 1) * 4;
+        }
+
+        // Queue the RAM reads for a patch, line_ptr is the line buffer and buffer the
+        // next free space in the line's sprite buffer.  Returns the last read id.
+        static uint32_t queue_patch_reads(pimoroni::APS6404& ram, BlendPatch& patch, uint8_t* line_ptr, uint32_t*& buffer);
+
+        // How the sprite is being loaded this frame
+        enum LoadState : uint8_t {
+            LOAD_NONE,      // Sprite disabled
+            LOAD_NOW,       // Loading during this VSYNC
+            LOAD_CACHED,    // Using the data loaded on a previous frame
+            LOAD_DEFERRED,  // Not displayed this frame, to be loaded during idle time
+            LOAD_CULLED,    // Entirely off screen, so not loaded or displayed
         };
 
-        void update_sprite(FrameDecode& frame_data);
+        void set_load_state(LoadState state) { load_state = state; }
+        LoadState get_load_state() const { return load_state; }
+
+        // Whether the loaded data is for the current sprite table index and RAM bank
+        bool has_cached_data(uint8_t bank) const { return loaded_idx == idx && loaded_bank == bank; }
+
+        // Forget the loaded data, when the line table storage has been used for something else
+        void clear_cached_data() { loaded_idx = -1; }
+
+        // Whether any part of the sprite can be within a frame of the given size.  Before the
+        // header has been read for this bank the largest possible sprite is assumed.
+        bool may_be_on_screen(uint8_t bank, int h_length, int v_length) const {
+            if (has_cached_data(bank)) return is_on_screen(h_length, v_length);
+            return overlaps_frame(x, y, MAX_SPRITE_WIDTH, MAX_SPRITE_HEIGHT, h_length, v_length);
+        }
+
+        // As above, using the header which must have been read
+        bool is_on_screen(int h_length, int v_length) const {
+            return overlaps_frame(x, y, header.width, header.height, h_length, v_length);
+        }
+
+        // Whether a sprite of the given size and position overlaps a frame of the given size
+        static bool overlaps_frame(int x, int y, int width, int height, int h_length, int v_length) {
+            return x < h_length && x + width > 0 && y < v_length && y + height > 0;
+        }
+
+        // Staged load of the sprite, so that reads for many sprites can be batched together.
+        // Each stage must wait for the read returned by the previous stage.  The size is decoded
+        // before the line table is read, so that off screen sprites can be culled and only the
+        // sprite's own lines are read.
+        uint32_t queue_header_read(FrameDecode& frame_data);
+        uint32_t queue_size_read(FrameDecode& frame_data);
+        void decode_size();
+        uint32_t queue_line_table_read(FrameDecode& frame_data);
+        void decode_line_table(FrameDecode& frame_data);
+
+        // Line table words a load of this sprite reads, the maximum if its size isn't known yet
+        uint32_t get_line_table_len_in_words(uint8_t bank) const {
+            if (has_cached_data(bank)) return FrameDecode::get_sprite_line_table_len_in_words(header.height);
+            return FrameDecode::SPRITE_LINE_TABLE_MAX_WORDS;
+        }
+
         void setup_patches(class DisplayDriver& disp);
+
+        // Set up the patches for a sprite that isn't held in a slot, from its decoded line table
+        static void setup_patches(class DisplayDriver& disp, const pico_stick::SpriteHeader& header, const pico_stick::SpriteLine* lines,
+                                  pico_stick::BlendMode blend_mode, int16_t x, int16_t y);
         static void apply_blend_patch_555_x(const BlendPatch& patch, uint8_t* frame_pixel_data);
         static void apply_blend_patch_555_y(const BlendPatch& patch, uint8_t* frame_pixel_data);
         static void apply_blend_patch_byte_x(const BlendPatch& patch, uint8_t* frame_pixel_data);
         static void apply_blend_patch_byte_y(const BlendPatch& patch, uint8_t* frame_pixel_data);
+        static void apply_direct_patch_x(const BlendPatch& patch, uint8_t* frame_pixel_data);
+        static void apply_direct_patch_y(const BlendPatch& patch, uint8_t* frame_pixel_data);
+        static void apply_dma_patch_x(const BlendPatch& patch, uint8_t* frame_pixel_data);
+        static void apply_dma_patch_y(const BlendPatch& patch, uint8_t* frame_pixel_data);
+
+        // Wait for the DMA copy started by the last apply_dma_patch call on this core
+        static void wait_for_patch_dma_x() { dma_channel_wait_for_finish_blocking(dma_channel_x); }
+        static void wait_for_patch_dma_y() { dma_channel_wait_for_finish_blocking(dma_channel_y); }
 
         static void init();
 
@@ -54,13 +142,17 @@ class Sprite {
         int16_t y;
         int16_t idx = -1;
         pico_stick::BlendMode blend_mode = pico_stick::BLEND_NONE;
+        LoadState load_state = LOAD_NONE;
+
+        int16_t loaded_idx = -1;
+        uint8_t loaded_bank;
 
         pico_stick::SpriteHeader header;
-        pico_stick::SpriteLine lines[MAX_SPRITE_HEIGHT];
-        alignas(4) uint8_t data[MAX_SPRITE_DATA_BYTES];
+        uint32_t size_data;  // Read by queue_size_read
+
+        // The raw line table is read into here and decoded in place
+        pico_stick::SpriteLine* lines = nullptr;
 
         static int dma_channel_x;
         static int dma_channel_y;
-        static uint32_t buffer_x[MAX_SPRITE_WIDTH / 2];
-        static uint32_t buffer_y[MAX_SPRITE_WIDTH / 2];
 };
\ No newline at end of file
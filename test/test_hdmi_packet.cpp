@@ -0,0 +1,143 @@
+#include <cstdio>
+#include <cstring>
+#include "hdmi_packet.hpp"
+
+// Checks the HDMI packet builder against reference packets.  The expected bytes were worked
+// out by hand from the HDMI 1.4 and CEA-861 specs, with the BCH parity from a bit serial
+// division by 1 + x^6 + x^7 + x^8, so they don't depend on the code under test.
+
+namespace {
+    int failures = 0;
+
+    void check_bytes(const char* name, const uint8_t* actual, const uint8_t* expected, int len) {
+        if (memcmp(actual, expected, len) == 0) return;
+
+        ++failures;
+        printf("FAIL %s\n  expected:", name);
+        for (int i = 0; i < len; ++i) printf(" %02x", expected[i]);
+        printf("\n  actual:  ");
+        for (int i = 0; i < len; ++i) printf(" %02x", actual[i]);
+        printf("\n");
+    }
+
+    void check_packet(const char* name, const hdmi::DataPacket& actual, const hdmi::DataPacket& expected) {
+        check_bytes(name, (const uint8_t*)&actual, (const uint8_t*)&expected, sizeof(hdmi::DataPacket));
+    }
+
+    void test_bch_parity() {
+        hdmi::DataPacket packet = {};
+        packet.compute_parity();
+        const hdmi::DataPacket zero_packet = {};
+        check_packet("BCH of zeros", packet, zero_packet);
+
+        // Header parity, BCH(32,24)
+        const uint8_t headers[][4] = {
+            { 0x84, 0x01, 0x0A, 0x4A },
+            { 0x82, 0x02, 0x0D, 0xE4 },
+            { 0x02, 0x0F, 0x00, 0xD0 },
+        };
+        for (const auto& header : headers) {
+            memcpy(packet.header, header, 3);
+            packet.compute_parity();
+            check_bytes("BCH header", packet.header, header, 4);
+        }
+
+        // Subpacket parity, BCH(64,56)
+        const uint8_t subpackets[][8] = {
+            { 0x00, 0x00, 0x69, 0x78, 0x00, 0x18, 0x00, 0x81 },
+            { 0x70, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x7D },
+            { 0x57, 0x10, 0x08, 0x00, 0x00, 0x00, 0x00, 0xCD },
+        };
+        for (const auto& subpacket : subpackets) {
+            for (int i = 0; i < 4; ++i) memcpy(packet.subpacket[i], subpacket, 7);
+            packet.compute_parity();
+            for (int i = 0; i < 4; ++i) check_bytes("BCH subpacket", packet.subpacket[i], subpacket, 8);
+        }
+    }
+
+    // 720x480p at 27MHz with 48kHz audio, N = 6144 and CTS = 27000 from HDMI 1.4 table 7-3
+    constexpr hdmi::DataPacket acr_packet_27mhz_48khz = {
+        { 0x01, 0x00, 0x00, 0x4A },
+        {
+            { 0x00, 0x00, 0x69, 0x78, 0x00, 0x18, 0x00, 0x81 },
+            { 0x00, 0x00, 0x69, 0x78, 0x00, 0x18, 0x00, 0x81 },
+            { 0x00, 0x00, 0x69, 0x78, 0x00, 0x18, 0x00, 0x81 },
+            { 0x00, 0x00, 0x69, 0x78, 0x00, 0x18, 0x00, 0x81 },
+        }
+    };
+
+    void test_audio_clock_regeneration() {
+        hdmi::DataPacket packet;
+        hdmi::build_audio_clock_regeneration_packet(packet, 27000, 48000);
+        check_packet("ACR 27MHz 48kHz", packet, acr_packet_27mhz_48khz);
+
+        // N = 6272 and CTS = 30000
+        const hdmi::DataPacket expected_44k = {
+            { 0x01, 0x00, 0x00, 0x4A },
+            {
+                { 0x00, 0x00, 0x75, 0x30, 0x00, 0x18, 0x80, 0x5A },
+                { 0x00, 0x00, 0x75, 0x30, 0x00, 0x18, 0x80, 0x5A },
+                { 0x00, 0x00, 0x75, 0x30, 0x00, 0x18, 0x80, 0x5A },
+                { 0x00, 0x00, 0x75, 0x30, 0x00, 0x18, 0x80, 0x5A },
+            }
+        };
+        hdmi::build_audio_clock_regeneration_packet(packet, 27000, 44100);
+        check_packet("ACR 27MHz 44.1kHz", packet, expected_44k);
+    }
+
+    void test_infoframes() {
+        // 2 channels, everything else refer to stream header, checksum 0x70
+        const hdmi::DataPacket expected_audio = {
+            { 0x84, 0x01, 0x0A, 0x4A },
+            {
+                { 0x70, 0x01, 0x00, 0x00, 0x00, 0x00, 0x00, 0x7D },
+            }
+        };
+        hdmi::DataPacket packet;
+        hdmi::build_audio_infoframe(packet);
+        check_packet("Audio InfoFrame", packet, expected_audio);
+
+        // RGB, active format same as picture, no VIC, checksum 0x57
+        const hdmi::DataPacket expected_avi = {
+            { 0x82, 0x02, 0x0D, 0xE4 },
+            {
+                { 0x57, 0x10, 0x08, 0x00, 0x00, 0x00, 0x00, 0xCD },
+            }
+        };
+        hdmi::build_avi_infoframe(packet, 0);
+        check_packet("AVI InfoFrame", packet, expected_avi);
+    }
+
+    void test_data_island() {
+        // The ACR packet above with HSYNC low and VSYNC high.  The guard bands are TERC4 0xE on
+        // lane 0 and 0b0100110011 on lanes 1 and 2, then a pixel for each header bit.
+        const uint32_t expected[3][hdmi::ISLAND_WORDS] = {
+            { 0x58D63, 0x6718E, 0x6719C, 0x6719C, 0x6719C, 0x6719C, 0x6719C, 0x6719C, 0x6719C,
+              0x6719C, 0x6719C, 0x6719C, 0x6719C, 0x58D9C, 0x58D9C, 0x6719C, 0x67163, 0x58D63 },
+            { 0x4CD33, 0xA729C, 0xA729C, 0xA729C, 0xA729C, 0xA72C3, 0xB0E9C, 0xA729C, 0xB0EC3,
+              0xA729C, 0xA729C, 0xA729C, 0xA72C3, 0xA729C, 0xA729C, 0xA72C3, 0xA729C, 0x4CD33 },
+            { 0x4CD33, 0xA729C, 0xA729C, 0xA729C, 0xA729C, 0xB0E9C, 0xA72C3, 0xB0E9C, 0xA72C3,
+              0xA729C, 0xA729C, 0xB0E9C, 0xA729C, 0xA729C, 0xA729C, 0xA729C, 0xB0E9C, 0x4CD33 },
+        };
+
+        uint32_t lanes[3][hdmi::ISLAND_WORDS];
+        hdmi::encode_data_island(acr_packet_27mhz_48khz, false, true, lanes);
+        for (int lane = 0; lane < 3; ++lane) {
+            check_bytes("TERC4 data island", (const uint8_t*)lanes[lane], (const uint8_t*)expected[lane], sizeof(expected[lane]));
+        }
+    }
+}
+
+int main() {
+    test_bch_parity();
+    test_audio_clock_regeneration();
+    test_infoframes();
+    test_data_island();
+
+    if (failures != 0) {
+        printf("%d checks failed\n", failures);
+        return 1;
+    }
+    printf("All checks passed\n");
+    return 0;
+}